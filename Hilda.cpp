@@ -1,3 +1,7 @@
+#define TINYGLTF_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+
 #include "Hilda.hpp"
 
 GLFWwindow* window;
@@ -6,6 +10,12 @@ tinygltf::TinyGLTF objectLoader;
 
 std::string assetFolder;
 std::string shaderFolder;
+std::string cacheFolder;
+std::string sceneFolder;
+std::string profilePath;
+std::string recordPath;
+std::string replayPath;
+std::string capturePath;
 
 ovrSession session;
 ovrGraphicsLuid luid;
@@ -13,12 +23,10 @@ ovrHmdDesc hmdDesc;
 ovrEyeRenderDesc eyeRenderDesc[2];
 ovrPosef hmdToEyeViewPose[2];
 ovrLayerEyeFov layer;
+ovrTimewarpProjectionDesc timewarpProjectionDesc;
 
 Framebuffer framebuffers[2];
-
-ovrMirrorTexture mirrorTexture;
-GLuint mirrorTextureBuffer;
-GLuint mirrorFramebuffer;
+HiddenArea hiddenAreas[2];
 
 uint32_t width;
 uint32_t height;
@@ -28,9 +36,14 @@ uint32_t nodeLimit;
 
 uint32_t currentImage;
 uint32_t frameCount;
+int64_t frameIndex;
+int64_t renderFrameIndex;
+thread_local int64_t profiledFrame;
+thread_local ProfileThread profileThread;
 uint32_t totalFrameCount;
 double_t timeDelta;
 double_t checkPoint;
+double_t totalTime;
 
 std::chrono::time_point<std::chrono::high_resolution_clock> previousTime;
 std::chrono::time_point<std::chrono::high_resolution_clock> currentTime;
@@ -39,6 +52,7 @@ uint8_t currentRooms[2];
 glm::vec3 previousPositions[2];
 glm::vec3 currentPositions[2];
 glm::mat4 currentTranslations[2];
+float_t yaw;
 
 std::vector<GLushort> indices;
 std::vector<Vertex> vertices;
@@ -46,13 +60,78 @@ std::vector<std::string> imageNames;
 std::vector<Image> textures;
 std::vector<Mesh> meshes;
 std::vector<Portal> portals;
-std::vector<Node> nodes;
 
-GLuint VAO;
-GLuint VBO;
-GLuint EBO;
-GLuint UBO;
-GLuint shaderProgram;
+MeshStreams meshStreams;
+PortalStreams portalStreams;
+PortalBounds portalBounds;
+PortalVisibility portalVisibility;
+std::vector<BvhNode> meshBvh;
+OccluderStreams occluderStreams;
+OcclusionBuffer occlusionBuffers[2];
+
+SpscQueue<RenderPacket, renderQueueCapacity> renderQueue;
+const RenderPacket* currentPacket;
+std::atomic<int64_t> begunFrames;
+
+std::string traversalLogs[2];
+
+std::atomic<uint64_t> allocationCount;
+uint64_t steadyAllocations;
+
+std::atomic<bool> jobsRunning;
+std::atomic<uint32_t> pendingJobs;
+std::vector<std::thread> jobWorkers;
+std::vector<std::unique_ptr<JobQueue>> jobQueues;
+thread_local uint32_t jobQueueIndex;
+
+bool profiling;
+std::atomic<uint32_t> profileCursor;
+std::vector<ProfileEvent> profileEvents;
+std::chrono::time_point<std::chrono::steady_clock> profileEpoch;
+
+std::vector<uint8_t> capturedPixels[2];
+
+bool lensMatched;
+bool multires;
+
+bool gpuCulling;
+bool lighting;
+bool quantized;
+bool shaderCacheDisabled;
+int64_t captureFrame;
+
+bool recording;
+bool replaying;
+std::ofstream poseRecorder;
+std::ifstream posePlayer;
+
+bool vulkan;
+bool headless;
+int64_t frameLimit;
+std::unique_ptr<Renderer> renderer;
+
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef NDEBUG
+// Debug builds count heap allocations to check steady-state frames
+void* operator new(size_t size) {
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+	if (auto pointer = std::malloc(size ? size : 1))
+		return pointer;
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept {
+	std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t size) noexcept {
+	static_cast<void>(size);
+	std::free(pointer);
+}
+#endif
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -91,169 +170,353 @@ void resizeEvent(GLFWwindow* handle, int width, int height) {
 
 //////////////////////////////////////////////////////////////////////////////
 
-glm::mat4 getNodeTranslation(const tinygltf::Node& node) {
-	glm::mat4 translation{ 1.0f };
-
-	for (auto index = 0u; index < node.translation.size(); index++)
-		translation[3][index] = node.translation.at(index);
+uint64_t profileTime() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - profileEpoch).count();
+}
 
-	return translation;
+uint32_t profileFrame() {
+	return static_cast<uint32_t>(profiledFrame);
 }
 
-glm::mat4 getNodeRotation(const tinygltf::Node& node) {
-	glm::mat4 rotation{ 1.0f };
+void setupProfiler() {
+	profiling = !profilePath.empty();
 
-	if (!node.rotation.empty())
-		rotation = glm::toMat4(glm::qua{ node.rotation.at(3), node.rotation.at(0), node.rotation.at(1), node.rotation.at(2) });
+	if (!profiling)
+		return;
 
-	return rotation;
+	profileCursor = 0;
+	profileEvents.resize(profileCapacity);
+	profileEpoch = std::chrono::steady_clock::now();
 }
 
-glm::mat4 getNodeScale(const tinygltf::Node& node) {
-	glm::mat4 scale{ 1.0f };
+uint32_t beginProfile(const char* name, int32_t eye, int32_t node) {
+	if (!profiling)
+		return UINT32_MAX;
 
-	for (auto index = 0u; index < node.scale.size(); index++)
-		scale[index][index] = node.scale.at(index);
+	auto index = profileCursor.fetch_add(1, std::memory_order_relaxed);
+	auto& event = profileEvents.at(index % profileCapacity);
 
-	return scale;
+	event = { name, profileFrame(), eye, node, false, profileThread, profileTime(), 0 };
+	return index;
 }
 
-glm::mat4 getNodeTransformation(const tinygltf::Node& node) {
-	return getNodeTranslation(node) * getNodeRotation(node) * getNodeScale(node);
+void endProfile(uint32_t index) {
+	if (index != UINT32_MAX)
+		profileEvents.at(index % profileCapacity).end = profileTime();
 }
 
-void loadTexture(std::string name) {
-	Image image{};
+void exportProfile() {
+	if (!profiling)
+		return;
 
-	auto pixels = stbi_load((assetFolder + name + ".jpg").c_str(), &image.width, &image.height, &image.channel, STBI_rgb_alpha);
-	image.channel = 4;
+	for (auto frameSlot = 0u; frameSlot < profileLatency; frameSlot++)
+		resolveGpuProfile(frameSlot);
 
-	glGenTextures(1, &image.texture);
-	glBindTexture(GL_TEXTURE_2D, image.texture);
+	std::ofstream file(profilePath);
+	auto cursor = profileCursor.load();
+	auto first = cursor > profileCapacity ? cursor - profileCapacity : 0;
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"CPU\"}}," << std::endl;
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"GPU\"}}," << std::endl;
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":2,\"args\":{\"name\":\"Render\"}}," << std::endl;
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":3,\"args\":{\"name\":\"Workers\"}}";
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-	glGenerateMipmap(GL_TEXTURE_2D);
+	for (auto index = first; index < cursor; index++) {
+		auto& event = profileEvents.at(index % profileCapacity);
 
-	textures.push_back(image);
-	stbi_image_free(pixels);
+		if (event.end <= event.begin)
+			continue;
+
+		file << "," << std::endl << "{\"name\":\"" << event.name << "\",\"cat\":\"" << (event.gpu ? "gpu" : "cpu")
+			<< "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << static_cast<uint32_t>(event.thread)
+			<< ",\"ts\":" << event.begin / 1000.0 << ",\"dur\":" << (event.end - event.begin) / 1000.0
+			<< ",\"args\":{\"frame\":" << event.frame << ",\"eye\":" << event.eye << ",\"node\":" << event.node << "}}";
+	}
+
+	file << std::endl << "]}" << std::endl;
+	std::cout << "Profile written to " << profilePath << std::endl;
 }
 
-void loadMesh(const tinygltf::Model& modelData, const tinygltf::Mesh& meshData, Type type,
-	const glm::mat4& translation, const glm::mat4& rotation, const glm::mat4& scale, uint8_t room) {
-	for (auto& primitive : meshData.primitives) {
-		auto& indexReference = modelData.bufferViews.at(primitive.indices);
-		auto& indexData = modelData.buffers.at(indexReference.buffer);
-		auto& material = modelData.materials.at(primitive.material);
-		auto textureIndex = 0u;
+//////////////////////////////////////////////////////////////////////////////
+
+void setupPoseRecording() {
+	PoseRecordHeader header{ poseRecordMagic, sizeof(PoseRecord) };
 
-		for (auto& value : material.values) {
-			if (!value.first.compare("baseColorTexture")) {
-				textureIndex = std::distance(imageNames.begin(), std::find(imageNames.begin(), imageNames.end(),
-					modelData.images.at(value.second.TextureIndex()).name));
-			}
+	recording = !recordPath.empty();
+	replaying = !replayPath.empty();
+
+	if (recording) {
+		poseRecorder.open(recordPath, std::ios::binary);
+		poseRecorder.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	}
+
+	if (replaying) {
+		PoseRecordHeader fileHeader{};
+
+		posePlayer.open(replayPath, std::ios::binary);
+		posePlayer.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader));
+
+		if (!posePlayer || fileHeader.magic != header.magic || fileHeader.recordSize != header.recordSize) {
+			std::cout << "Pose replay file " << replayPath << " is missing or incompatible" << std::endl;
+			posePlayer.setstate(std::ios::failbit);
 		}
+	}
+}
+
+bool readPoseRecord(PoseRecord& record) {
+	posePlayer.read(reinterpret_cast<char*>(&record), sizeof(record));
+	return static_cast<bool>(posePlayer);
+}
 
-		Mesh mesh{};
+void writePoseRecord(const PoseRecord& record) {
+	if (recording)
+		poseRecorder.write(reinterpret_cast<const char*>(&record), sizeof(record));
+}
 
-		mesh.indexOffset = indices.size();
-		mesh.indexLength = indexReference.byteLength / sizeof(GLushort);
+//////////////////////////////////////////////////////////////////////////////
 
-		mesh.room = room;
-		mesh.transform = translation * rotation * scale;
+void writeImage(const std::string path, uint32_t imageWidth, uint32_t imageHeight, const std::vector<uint8_t>& pixels) {
+	std::ofstream file(path, std::ios::binary);
+	file << "P6\n" << imageWidth << " " << imageHeight << "\n255\n";
 
-		indices.resize(mesh.indexOffset + mesh.indexLength);
-		std::memcpy(indices.data() + mesh.indexOffset, indexData.data.data() + indexReference.byteOffset, indexReference.byteLength);
+	// GL rows start at the bottom, image rows at the top
+	for (auto row = imageHeight; row > 0; row--)
+		file.write(reinterpret_cast<const char*>(pixels.data() + (row - 1) * imageWidth * 3), imageWidth * 3);
+}
 
-		std::vector<glm::vec3> positions;
-		std::vector<glm::vec3> normals;
-		std::vector<glm::vec2> texcoords;
+bool readImage(const std::string path, uint32_t& imageWidth, uint32_t& imageHeight, std::vector<uint8_t>& pixels) {
+	std::ifstream file(path, std::ios::binary);
+	std::string format;
+	uint32_t maximum;
 
-		for (auto& attribute : primitive.attributes) {
-			auto& accessor = modelData.accessors.at(attribute.second);
-			auto& primitiveView = modelData.bufferViews.at(accessor.bufferView);
-			auto& primitiveBuffer = modelData.buffers.at(primitiveView.buffer);
+	file >> format >> imageWidth >> imageHeight >> maximum;
+	file.get();
 
-			if (attribute.first.compare("POSITION") == 0) {
-				positions.resize(primitiveView.byteLength / sizeof(glm::vec3));
-				std::memcpy(positions.data(), primitiveBuffer.data.data() + primitiveView.byteOffset, primitiveView.byteLength);
-			}
-			else if (attribute.first.compare("NORMAL") == 0) {
-				normals.resize(primitiveView.byteLength / sizeof(glm::vec3));
-				std::memcpy(normals.data(), primitiveBuffer.data.data() + primitiveView.byteOffset, primitiveView.byteLength);
-			}
-			else if (attribute.first.compare("TEXCOORD_0") == 0) {
-				texcoords.resize(primitiveView.byteLength / sizeof(glm::vec2));
-				std::memcpy(texcoords.data(), primitiveBuffer.data.data() + primitiveView.byteOffset, primitiveView.byteLength);
-			}
-		}
+	if (!file || format.compare("P6") || maximum != 255)
+		return false;
 
-		mesh.vertexOffset = vertices.size();
-		mesh.vertexLength = texcoords.size();
-		mesh.textureIndex = textureIndex;
+	pixels.resize(imageWidth * imageHeight * 3);
+	file.read(reinterpret_cast<char*>(pixels.data()), pixels.size());
 
-		for (auto index = 0u; index < mesh.vertexLength; index++) {
-			Vertex vertex{};
-			vertex.position = mesh.transform * glm::vec4{ positions.at(index), 1.0f };
-			vertex.normal = glm::normalize(glm::vec3{ mesh.transform * glm::vec4{ glm::normalize(normals.at(index)), 0.0f } });
-			vertex.texture = texcoords.at(index);
-			vertices.push_back(vertex);
-		}
+	return static_cast<bool>(file);
+}
 
-		auto min = glm::vec3{ std::numeric_limits<float_t>::max() }, max = glm::vec3{ -std::numeric_limits<float_t>::max() };
+void writeCaptures() {
+	for (int eye = 0; eye < 2; eye++) {
+		auto& framebuffer = framebuffers[eye];
 
-		for (auto index = 0u; index < mesh.vertexLength; index++) {
-			auto& vertex = vertices.at(mesh.vertexOffset + index);
+		if (!capturedPixels[eye].empty())
+			writeImage(capturePath + std::to_string(eye) + ".ppm", framebuffer.viewportWidth, framebuffer.viewportHeight, capturedPixels[eye]);
+	}
+}
 
-			min.x = std::min(min.x, vertex.position.x);
-			min.y = std::min(min.y, vertex.position.y);
-			min.z = std::min(min.z, vertex.position.z);
+int32_t compareImages(const std::string firstPath, const std::string secondPath, double_t minimumPsnr) {
+	uint32_t firstWidth, firstHeight, secondWidth, secondHeight;
+	std::vector<uint8_t> firstPixels, secondPixels;
 
-			max.x = std::max(max.x, vertex.position.x);
-			max.y = std::max(max.y, vertex.position.y);
-			max.z = std::max(max.z, vertex.position.z);
-		}
+	if (!readImage(firstPath, firstWidth, firstHeight, firstPixels) || !readImage(secondPath, secondWidth, secondHeight, secondPixels) ||
+		firstWidth != secondWidth || firstHeight != secondHeight) {
+		std::cout << "Images are missing or have different sizes" << std::endl;
+		return 2;
+	}
 
-		mesh.origin = glm::vec3{ mesh.transform * glm::vec4{ 0.0f, 0.0f, 0.0f, 1.0f } };
-		mesh.minBorders = min;
-		mesh.maxBorders = max;
+	auto squaredError = 0.0;
+	auto maximumError = 0;
 
-		if (type == Type::Mesh) {
-			meshCount++;
-			meshes.push_back(mesh);
-		}
+	for (auto index = 0u; index < firstPixels.size(); index++) {
+		auto error = std::abs(int32_t(firstPixels.at(index)) - int32_t(secondPixels.at(index)));
+
+		squaredError += error * error;
+		maximumError = std::max(maximumError, error);
+	}
+
+	auto meanSquaredError = squaredError / firstPixels.size();
+	auto psnr = meanSquaredError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / meanSquaredError) : std::numeric_limits<double_t>::infinity();
+
+	std::cout << "PSNR: " << psnr << " dB, maximum channel difference: " << maximumError << std::endl;
+	return psnr < minimumPsnr ? 1 : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool runJob() {
+	Job job{};
+	auto found = false;
+
+	for (auto offset = 0u; offset < jobQueues.size() && !found; offset++) {
+		auto& queue = *jobQueues.at((jobQueueIndex + offset) % jobQueues.size());
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		if (queue.head == queue.tail)
+			continue;
+
+		if (offset == 0)
+			job = std::move(queue.jobs.at(--queue.tail % jobCapacity));
+		else
+			job = std::move(queue.jobs.at(queue.head++ % jobCapacity));
+
+		found = true;
+	}
+
+	if (!found)
+		return false;
+
+	pendingJobs.fetch_sub(1, std::memory_order_relaxed);
 
-		else if (type == Type::Portal) {
-			Portal portal{};
+	job.task();
+	job.counter->fetch_sub(1, std::memory_order_release);
+
+	return true;
+}
 
-			portal.mesh = mesh;
-			portal.direction = glm::normalize(glm::vec3(mesh.transform * glm::vec4{ 0.0f, 0.0f, -1.0f, 0.0f }));
+void submitJob(std::atomic<uint32_t>& counter, std::function<void()> task) {
+	auto queued = false;
 
-			portalCount++;
-			portals.push_back(portal);
+	{
+		auto& queue = *jobQueues.at(jobQueueIndex);
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		// Counted before it is visible, so a worker never sleeps on zero while the job sits in a deque
+		if (queue.tail - queue.head < jobCapacity) {
+			counter.fetch_add(1, std::memory_order_relaxed);
+			pendingJobs.fetch_add(1, std::memory_order_release);
+			queue.jobs.at(queue.tail++ % jobCapacity) = { std::move(task), &counter };
+			queued = true;
 		}
 	}
+
+	// A full deque runs the job inline, after unlocking so the task may submit too
+	if (queued)
+		pendingJobs.notify_one();
+	else
+		task();
 }
 
-void loadModel(Type type, const std::string name, uint8_t room) {
-	std::string error, warning;
-	tinygltf::Model model;
+void waitJobs(std::atomic<uint32_t>& counter) {
+	while (counter.load(std::memory_order_acquire) != 0)
+		if (!runJob())
+			std::this_thread::yield();
+}
 
-	auto result = objectLoader.LoadASCIIFromFile(&model, &error, &warning, assetFolder + name + ".gltf");
+void jobLoop(uint32_t index) {
+	jobQueueIndex = index;
+	profileThread = ProfileThread::Worker;
 
-#ifndef NDEBUG
-	if (!warning.empty())
-		std::cout << "GLTF Warning: " << warning << std::endl;
-	if (!error.empty())
-		std::cout << "GLTF Error: " << error << std::endl;
-	if (!result)
-		return;
-#endif
+	while (jobsRunning.load(std::memory_order_acquire)) {
+		auto pending = pendingJobs.load(std::memory_order_acquire);
+
+		if (!runJob() && pending == 0)
+			pendingJobs.wait(0, std::memory_order_acquire);
+	}
+}
+
+void setupJobs() {
+	auto hardwareThreads = std::thread::hardware_concurrency();
+	auto workerCount = hardwareThreads > 3 ? hardwareThreads - 2 : 1u;
+
+	jobsRunning.store(true, std::memory_order_release);
+	pendingJobs = 0;
+	jobQueueIndex = 0;
+
+	for (auto index = 0u; index <= workerCount + 1; index++) {
+		jobQueues.push_back(std::make_unique<JobQueue>());
+		jobQueues.back()->head = jobQueues.back()->tail = 0;
+	}
+
+	for (auto index = 1u; index <= workerCount; index++)
+		jobWorkers.emplace_back(jobLoop, index);
+}
+
+void cleanJobs() {
+	jobsRunning.store(false, std::memory_order_release);
+
+	pendingJobs.fetch_add(1, std::memory_order_release);
+	pendingJobs.notify_all();
+
+	for (auto& worker : jobWorkers)
+		worker.join();
+
+	jobWorkers.clear();
+	jobQueues.clear();
+}
+
+int32_t testJobs(uint32_t count) {
+	setupJobs();
+
+	std::atomic<uint64_t> flatSum = 0, nestedSum = 0, overflowSum = 0;
+
+	parallelFor(count, 16, [&](uint32_t first, uint32_t last) {
+		for (auto index = first; index < last; index++)
+			flatSum.fetch_add(index, std::memory_order_relaxed);
+	});
+
+	parallelFor(count, 16, [&](uint32_t first, uint32_t last) {
+		for (auto index = first; index < last; index++)
+			parallelFor(count, 64, [&](uint32_t nestedFirst, uint32_t nestedLast) {
+				for (auto nested = nestedFirst; nested < nestedLast; nested++)
+					nestedSum.fetch_add(nested, std::memory_order_relaxed);
+			});
+	});
+
+	parallelFor(4 * jobCapacity, 1, [&](uint32_t first, uint32_t) {
+		parallelFor(count, 64, [&](uint32_t nestedFirst, uint32_t nestedLast) {
+			for (auto nested = nestedFirst; nested < nestedLast; nested++)
+				overflowSum.fetch_add(nested + first, std::memory_order_relaxed);
+		});
+	});
+
+	auto queueCount = jobQueues.size();
+	cleanJobs();
+
+	uint64_t triangle = uint64_t(count) * (count - 1) / 2;
+	uint64_t overflowExpected = 4 * jobCapacity * triangle + uint64_t(count) * (4 * jobCapacity) * (4 * jobCapacity - 1) / 2;
+	auto mismatches = (flatSum != triangle) + (nestedSum != count * triangle) + (overflowSum != overflowExpected);
+
+	std::cout << count << " items, " << queueCount << " deques, " << mismatches << " mismatches" << std::endl;
+	return mismatches ? 1 : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+glm::mat4 getNodeTranslation(const GltfNode& node) {
+	return glm::translate(glm::mat4{ 1.0f }, node.translation);
+}
+
+glm::mat4 getNodeRotation(const GltfNode& node) {
+	return glm::toMat4(node.rotation);
+}
+
+glm::mat4 getNodeScale(const GltfNode& node) {
+	return glm::scale(glm::mat4{ 1.0f }, node.scale);
+}
+
+glm::mat4 getNodeTransformation(const GltfNode& node) {
+	return getNodeTranslation(node) * getNodeRotation(node) * getNodeScale(node);
+}
+
+uint8_t* decodeTexture(const std::string name, Image& image) {
+	auto pixels = stbi_load((assetFolder + name + ".jpg").c_str(), &image.width, &image.height, &image.channel, STBI_rgb_alpha);
+	image.channel = 4;
+
+	return pixels;
+}
+
+void uploadTexture(Image& image, uint8_t* pixels) {
+	renderer->uploadTexture(image, pixels);
+
+	textures.push_back(image);
+	stbi_image_free(pixels);
+}
+
+void loadTexture(const std::string name) {
+	Image image{};
+	auto pixels = decodeTexture(name, image);
+
+	uploadTexture(image, pixels);
+}
 
+void addModel(Type type, const GltfModel& model, uint8_t room) {
 	if (type == Type::Camera) {
 		auto& node = model.nodes.front();
 		currentRooms[0] = currentRooms[1] = room;
@@ -261,16 +524,18 @@ void loadModel(Type type, const std::string name, uint8_t room) {
 	}
 
 	else {
-		for (auto& image : model.images) {
-			if (std::find(imageNames.begin(), imageNames.end(), image.name) == imageNames.end()) {
-				imageNames.push_back(image.name);
-				loadTexture(image.name);
+		for (auto& name : model.imageNames) {
+			if (std::find(imageNames.begin(), imageNames.end(), name) == imageNames.end()) {
+				imageNames.push_back(name);
+				loadTexture(name);
 			}
 		}
 
 		for (auto& node : model.nodes) {
-			auto& mesh = model.meshes.at(node.mesh);
-			loadMesh(model, mesh, type, getNodeTranslation(node), getNodeRotation(node), getNodeScale(node), room);
+			if (node.mesh < 0)
+				continue;
+
+			loadMesh(model, model.meshes.at(node.mesh), type, getNodeTranslation(node), getNodeRotation(node), getNodeScale(node), room);
 		}
 
 		if (type == Type::Portal && portals.size() % 2 == 0) {
@@ -280,6 +545,9 @@ void loadModel(Type type, const std::string name, uint8_t room) {
 			bluePortal.targetRoom = orangePortal.mesh.room;
 			orangePortal.targetRoom = bluePortal.mesh.room;
 
+			bluePortal.pairIndex = static_cast<int32_t>(portals.size() - 1);
+			orangePortal.pairIndex = static_cast<int32_t>(portals.size() - 2);
+
 			bluePortal.translation = orangePortal.mesh.origin - bluePortal.mesh.origin;
 			orangePortal.translation = bluePortal.mesh.origin - orangePortal.mesh.origin;
 
@@ -288,7 +556,84 @@ void loadModel(Type type, const std::string name, uint8_t room) {
 	}
 }
 
+void loadModel(Type type, const std::string name, uint8_t room) {
+	std::string messages;
+	GltfModel model;
+
+	auto result = readModel(model, name, messages);
+	std::cout << messages;
+
+	if (result)
+		addModel(type, model, room);
+
+	closeModel(model);
+}
+
+void loadScene(const std::string folder) {
+	assetFolder = folder;
+
+	std::ifstream file(assetFolder + "scene.txt");
+	std::string type, name;
+	uint32_t room;
+
+	std::vector<Type> types;
+	std::vector<std::string> names;
+	std::vector<uint8_t> rooms;
+
+	while (file >> type >> name >> room) {
+		types.push_back(!type.compare("camera") ? Type::Camera : !type.compare("portal") ? Type::Portal : Type::Mesh);
+		names.push_back(name);
+		rooms.push_back(room);
+	}
+
+	std::vector<GltfModel> models(names.size());
+	std::vector<std::string> messages(names.size());
+	std::unique_ptr<bool[]> results(new bool[names.size()]);
+
+	parallelFor(names.size(), 1, [&](uint32_t first, uint32_t last) {
+		for (auto index = first; index < last; index++)
+			results[index] = readModel(models.at(index), names.at(index), messages.at(index));
+	});
+
+	std::vector<std::string> textureNames;
+
+	for (auto index = 0u; index < models.size(); index++) {
+		std::cout << messages.at(index);
+
+		if (results[index] && types.at(index) != Type::Camera)
+			for (auto& name : models.at(index).imageNames)
+				if (std::find(imageNames.begin(), imageNames.end(), name) == imageNames.end() &&
+					std::find(textureNames.begin(), textureNames.end(), name) == textureNames.end())
+					textureNames.push_back(name);
+	}
+
+	std::vector<Image> images(textureNames.size());
+	std::vector<uint8_t*> pixels(textureNames.size());
+
+	parallelFor(textureNames.size(), 1, [&](uint32_t first, uint32_t last) {
+		for (auto index = first; index < last; index++)
+			pixels.at(index) = decodeTexture(textureNames.at(index), images.at(index));
+	});
+
+	for (auto index = 0u; index < textureNames.size(); index++) {
+		imageNames.push_back(textureNames.at(index));
+		uploadTexture(images.at(index), pixels.at(index));
+	}
+
+	for (auto index = 0u; index < models.size(); index++) {
+		if (results[index])
+			addModel(types.at(index), models.at(index), rooms.at(index));
+
+		closeModel(models.at(index));
+	}
+}
+
 void createScene() {
+	if (!sceneFolder.empty()) {
+		loadScene(sceneFolder);
+		return;
+	}
+
 	assetFolder = "Assets/backroom/";
 
 	loadModel(Type::Camera, "c", 1);
@@ -330,504 +675,1899 @@ void createScene() {
 	*/
 }
 
-//////////////////////////////////////////////////////////////////////////////
+void buildBvh(uint32_t index, uint32_t first, uint32_t last) {
+	auto min = glm::vec3{ std::numeric_limits<float_t>::max() }, max = glm::vec3{ -std::numeric_limits<float_t>::max() };
+	auto centerMin = min, centerMax = max;
 
-GLuint createShader(std::string path, GLenum type)
-{
-	std::ifstream file;
-	file.open((shaderFolder + path).c_str());
-	std::stringstream stream;
-	stream << file.rdbuf();
-	file.close();
+	for (auto mesh = first; mesh < last; mesh++) {
+		auto& borders = meshes.at(mesh);
+		auto center = 0.5f * (borders.minBorders + borders.maxBorders);
 
-	auto source = stream.str();
-	auto code = source.c_str();
+		min = glm::min(min, borders.minBorders);
+		max = glm::max(max, borders.maxBorders);
+		centerMin = glm::min(centerMin, center);
+		centerMax = glm::max(centerMax, center);
+	}
 
-	GLuint shader = glCreateShader(type);
-	glShaderSource(shader, 1, &code, NULL);
-	glCompileShader(shader);
+	meshBvh.at(index) = { min, max, first, last - first, 0 };
 
-#ifndef NDEBUG
-	GLint result;
-	GLchar log[512];
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
+	if (last - first <= bvhLeafSize)
+		return;
 
-	if (!result)
-	{
-		glGetShaderInfoLog(shader, 512, NULL, log);
-		std::cout << log << std::endl;
-	}
-#endif
+	// Median split on the longest axis, leaves are contiguous ranges of meshes
+	auto extent = centerMax - centerMin;
+	auto axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	auto middle = first + (last - first) / 2;
 
-	return shader;
+	std::nth_element(meshes.begin() + first, meshes.begin() + middle, meshes.begin() + last, [axis](const Mesh& a, const Mesh& b) {
+		return a.minBorders[axis] + a.maxBorders[axis] < b.minBorders[axis] + b.maxBorders[axis];
+	});
+
+	auto left = static_cast<uint32_t>(meshBvh.size());
+	meshBvh.resize(left + 2);
+
+	meshBvh.at(index).left = left;
+	meshBvh.at(index).count = 0;
+
+	buildBvh(left, first, middle);
+	buildBvh(left + 1, middle, last);
 }
 
-GLuint createProgram(GLuint vertex, GLuint fragment)
-{
-	GLuint program = glCreateProgram();
-	glAttachShader(program, vertex);
-	glAttachShader(program, fragment);
-	glLinkProgram(program);
+void compileScene() {
+	std::stable_sort(meshes.begin(), meshes.end(), [](const Mesh& first, const Mesh& second) { return first.room < second.room; });
 
-#ifndef NDEBUG
-	int result;
-	char log[512];
-	glGetProgramiv(program, GL_LINK_STATUS, &result);
+	meshStreams = {};
+	meshStreams.roomOffsets.assign(roomCapacity + 1, 0);
+	meshStreams.roomBvh.assign(roomCapacity, UINT32_MAX);
 
-	if (!result)
-	{
-		glGetProgramInfoLog(program, 512, NULL, log);
-		std::cout << log << std::endl;
+	for (auto& mesh : meshes)
+		meshStreams.roomOffsets.at(mesh.room + 1)++;
+
+	for (auto room = 0u; room < roomCapacity; room++)
+		meshStreams.roomOffsets.at(room + 1) += meshStreams.roomOffsets.at(room);
+
+	meshBvh.clear();
+
+	for (auto room = 0u; room < roomCapacity; room++)
+		if (meshStreams.roomOffsets.at(room) != meshStreams.roomOffsets.at(room + 1)) {
+			meshStreams.roomBvh.at(room) = static_cast<uint32_t>(meshBvh.size());
+			meshBvh.emplace_back();
+
+			buildBvh(meshStreams.roomBvh.at(room), meshStreams.roomOffsets.at(room), meshStreams.roomOffsets.at(room + 1));
+		}
+
+	for (auto& mesh : meshes) {
+		meshStreams.indexOffsets.push_back(mesh.indexOffset);
+		meshStreams.indexLengths.push_back(mesh.indexLength);
+		meshStreams.vertexOffsets.push_back(mesh.vertexOffset);
+		meshStreams.textureIndices.push_back(mesh.textureIndex);
 	}
-#endif
 
-	return program;
-}
+	occluderStreams = {};
 
-void setup() {
-	ovr_Initialize(nullptr);
-	ovr_Create(&session, &luid);
+	for (auto& mesh : meshes) {
+		auto triangleCount = mesh.indexLength / 3 <= occluderTriangleLimit ? mesh.indexLength / 3 : 0;
 
-	hmdDesc = ovr_GetHmdDesc(session);
+		occluderStreams.triangleOffsets.push_back(static_cast<uint32_t>(occluderStreams.corners.size() / 3));
+		occluderStreams.triangleCounts.push_back(triangleCount);
 
-	width = hmdDesc.Resolution.w / 2;
-	height = hmdDesc.Resolution.h / 2;
+		for (auto index = 0u; index < triangleCount * 3; index++)
+			occluderStreams.corners.push_back(vertices.at(mesh.vertexOffset + indices.at(mesh.indexOffset + index)).position);
+	}
 
-	nodeLimit = 15;	// 2 ^ 4 - 1 - 1
+	portalStreams = {};
 
-	currentImage = 0;
-	frameCount = 0;
-	totalFrameCount = 0;
-	checkPoint = 0.0f;
+	for (auto& portal : portals) {
+		portalStreams.indexOffsets.push_back(portal.mesh.indexOffset);
+		portalStreams.indexLengths.push_back(portal.mesh.indexLength);
+		portalStreams.vertexOffsets.push_back(portal.mesh.vertexOffset);
 
-	glfwInit();
+		portalStreams.rooms.push_back(portal.mesh.room);
+		portalStreams.targetRooms.push_back(portal.targetRoom);
+		portalStreams.pairIndices.push_back(portal.pairIndex);
+		portalStreams.translations.push_back(portal.translation);
+	}
 
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-	//glfwWindowHint(GLFW_TRANSPARENT_FRAMEBUFFER, 1);
+	portalStreams.roomOffsets.assign(roomCapacity + 1, 0);
+	portalStreams.roomPortals.resize(portals.size());
 
-	window = glfwCreateWindow(width, height, "", nullptr, nullptr);
+	for (auto& portal : portals)
+		portalStreams.roomOffsets.at(portal.mesh.room + 1)++;
 
-	glfwMakeContextCurrent(window);
-	glfwSetKeyCallback(window, keyboardCallback);
-	glfwSetFramebufferSizeCallback(window, resizeEvent);
+	for (auto room = 0u; room < roomCapacity; room++)
+		portalStreams.roomOffsets.at(room + 1) += portalStreams.roomOffsets.at(room);
 
-	glfwSwapInterval(0);
+	std::vector<uint32_t> cursors(portalStreams.roomOffsets.begin(), portalStreams.roomOffsets.end() - 1);
 
-	gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+	for (auto index = 0u; index < portals.size(); index++)
+		portalStreams.roomPortals.at(cursors.at(portals.at(index).mesh.room)++) = index;
 
-	createScene();
+	portalBounds = {};
 
-	glEnable(GL_FRAMEBUFFER_SRGB);
-	glEnable(GL_CULL_FACE);
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_STENCIL_TEST);
-	glEnable(GL_SCISSOR_TEST);
+	for (auto index : portalStreams.roomPortals) {
+		auto& portal = portals.at(index);
 
-	glFrontFace(GL_CCW);
-	glCullFace(GL_BACK);
+		portalBounds.originX.push_back(portal.mesh.origin.x);
+		portalBounds.originY.push_back(portal.mesh.origin.y);
+		portalBounds.originZ.push_back(portal.mesh.origin.z);
+		portalBounds.normalX.push_back(portal.direction.x);
+		portalBounds.normalY.push_back(portal.direction.y);
+		portalBounds.normalZ.push_back(portal.direction.z);
 
-	glDepthMask(GL_TRUE);
-	glDepthFunc(GL_LESS);
+		portalBounds.minX.push_back(portal.mesh.minBorders.x);
+		portalBounds.minY.push_back(portal.mesh.minBorders.y);
+		portalBounds.minZ.push_back(portal.mesh.minBorders.z);
+		portalBounds.maxX.push_back(portal.mesh.maxBorders.x);
+		portalBounds.maxY.push_back(portal.mesh.maxBorders.y);
+		portalBounds.maxZ.push_back(portal.mesh.maxBorders.z);
+	}
+}
 
-	glClearDepth(1.0f);
-	glClearStencil(0);
-	glClearColor(0.4f, 0.8f, 1.0f, 1.0f);
+//////////////////////////////////////////////////////////////////////////////
 
-	for (int eye = 0; eye < 2; eye++) {
-		auto& framebuffer = framebuffers[eye];
+void portalPoints(uint32_t portalIndex, const glm::vec3& offset, std::vector<glm::vec3>& points) {
+	auto& mesh = portals.at(portalIndex).mesh;
+	points.clear();
 
-		ovrSizei idealTextureSize = ovr_GetFovTextureSize(session, ovrEyeType(eye), hmdDesc.DefaultEyeFov[eye], 1);
+	if (mesh.vertexLength && mesh.vertexLength <= portalPointLimit)
+		for (auto index = mesh.vertexOffset; index < mesh.vertexOffset + mesh.vertexLength; index++)
+			points.push_back(vertices.at(index).position + offset);
 
-		framebuffer.width = idealTextureSize.w;
-		framebuffer.height = idealTextureSize.h;
+	else
+		for (auto corner = 0u; corner < 8; corner++)
+			points.push_back(glm::vec3{ corner & 1 ? mesh.maxBorders.x : mesh.minBorders.x, corner & 2 ? mesh.maxBorders.y : mesh.minBorders.y,
+				corner & 4 ? mesh.maxBorders.z : mesh.minBorders.z } + offset);
+}
 
-		ovrTextureSwapChainDesc desc = {};
-		desc.Type = ovrTexture_2D;
-		desc.ArraySize = 1;
-		desc.Width = framebuffer.width;
-		desc.Height = framebuffer.height;
-		desc.MipLevels = 1;
-		desc.SampleCount = 1;
-		desc.StaticImage = ovrFalse;
+bool behindPlane(const glm::vec4& plane, const std::vector<glm::vec3>& points) {
+	for (auto& point : points)
+		if (glm::dot(glm::vec3{ plane }, point) + plane.w >= -epsilon)
+			return false;
 
-		int length;
+	return true;
+}
 
-		desc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+bool beyondPlane(const glm::vec4& plane, const std::vector<glm::vec3>& points) {
+	for (auto& point : points)
+		if (glm::dot(glm::vec3{ plane }, point) + plane.w > epsilon)
+			return true;
 
-		ovr_CreateTextureSwapChainGL(session, &desc, &framebuffer.textureSwapchain);
-		ovr_GetTextureSwapChainLength(session, framebuffer.textureSwapchain, &length);
+	return false;
+}
 
-		for (int i = 0; i < length; i++)
-		{
-			GLuint textureIndex;
-			ovr_GetTextureSwapChainBufferGL(session, framebuffer.textureSwapchain, i, &textureIndex);
-			glBindTexture(GL_TEXTURE_2D, textureIndex);
-
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		}
+void separatingPlanes(const std::vector<glm::vec3>& source, const std::vector<glm::vec3>& target, bool flipped, std::vector<glm::vec4>& planes) {
+	// Planes through an edge of one portal and a corner of the other that keep the portals apart bound every line through both
+	for (auto first = 0u; first < source.size(); first++)
+		for (auto second = first + 1; second < source.size(); second++)
+			for (auto& corner : target) {
+				auto normal = glm::cross(source[second] - source[first], corner - source[first]);
 
-		desc.Format = OVR_FORMAT_D32_FLOAT_S8X24_UINT;
+				if (glm::length(normal) < epsilon)
+					continue;
 
-		ovr_CreateTextureSwapChainGL(session, &desc, &framebuffer.depthStencilSwapchain);
-		ovr_GetTextureSwapChainLength(session, framebuffer.depthStencilSwapchain, &length);
+				normal = glm::normalize(normal);
+				auto sourceMin = std::numeric_limits<float_t>::max(), sourceMax = -std::numeric_limits<float_t>::max();
+				auto targetMin = std::numeric_limits<float_t>::max(), targetMax = -std::numeric_limits<float_t>::max();
 
-		for (int i = 0; i < length; ++i)
-		{
-			GLuint textureIndex;
-			ovr_GetTextureSwapChainBufferGL(session, framebuffer.depthStencilSwapchain, i, &textureIndex);
-			glBindTexture(GL_TEXTURE_2D, textureIndex);
-
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		}
+				for (auto& point : source) {
+					sourceMin = std::min(sourceMin, glm::dot(normal, point - source[first]));
+					sourceMax = std::max(sourceMax, glm::dot(normal, point - source[first]));
+				}
 
-		glGenFramebuffers(1, &framebuffer.framebuffer);
-	}
+				for (auto& point : target) {
+					targetMin = std::min(targetMin, glm::dot(normal, point - source[first]));
+					targetMax = std::max(targetMax, glm::dot(normal, point - source[first]));
+				}
 
-	ovrMirrorTextureDesc mirrorDescriptor{};
-	mirrorDescriptor.Width = width;
-	mirrorDescriptor.Height = width;
-	mirrorDescriptor.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+				auto sign = 0.0f;
 
-	ovr_CreateMirrorTextureWithOptionsGL(session, &mirrorDescriptor, &mirrorTexture);
-	ovr_GetMirrorTextureBufferGL(session, mirrorTexture, &mirrorTextureBuffer);
+				if (sourceMax <= epsilon && targetMin >= -epsilon && (sourceMin < -epsilon || targetMax > epsilon))
+					sign = 1.0f;
+				else if (sourceMin >= -epsilon && targetMax <= epsilon && (sourceMax > epsilon || targetMin < -epsilon))
+					sign = -1.0f;
 
-	glGenFramebuffers(1, &mirrorFramebuffer);
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, mirrorFramebuffer);
-	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mirrorTextureBuffer, 0);
-	glFramebufferRenderbuffer(GL_READ_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, 0);
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+				if (sign == 0.0f)
+					continue;
 
-	ovr_SetTrackingOriginType(session, ovrTrackingOrigin_FloorLevel);
+				// Lines leaving the target side of the pair stay on it, whichever portal the edge came from
+				if (flipped)
+					sign = -sign;
 
-	shaderFolder = "Shaders/";
-	GLuint vertexShader = createShader("vertex.vert", GL_VERTEX_SHADER);
-	GLuint fragmentShader = createShader("fragment.frag", GL_FRAGMENT_SHADER);
-	shaderProgram = createProgram(vertexShader, fragmentShader);
-
-	glDetachShader(shaderProgram, vertexShader);
-	glDetachShader(shaderProgram, fragmentShader);
-	glDeleteShader(vertexShader);
-	glDeleteShader(fragmentShader);
-	glUseProgram(shaderProgram);
-
-	glGenVertexArrays(1, &VAO);
-	glBindVertexArray(VAO);
-
-	glGenBuffers(1, &VBO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)sizeof(glm::vec3));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)(2 * sizeof(glm::vec3)));
-	glEnableVertexAttribArray(2);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	glGenBuffers(1, &EBO);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * indices.size(), indices.data(), GL_STATIC_DRAW);
-
-	glGenBuffers(1, &UBO);
-	glBindBuffer(GL_UNIFORM_BUFFER, UBO);
-	glUniformBlockBinding(shaderProgram, 0, 0);
-	glBindBufferBase(GL_UNIFORM_BUFFER, 0, UBO);
+				planes.push_back(sign * glm::vec4{ normal, -glm::dot(normal, source[first]) });
+			}
 }
 
-//////////////////////////////////////////////////////////////////////////////
+void visiblePortals(uint32_t portalIndex, std::vector<uint32_t>& sideSets, std::vector<std::vector<uint32_t>>& sequenceSets) {
+	auto& portal = portals.at(portalIndex);
+	auto room = portalStreams.targetRooms[portalIndex];
+	auto pairIndex = portalStreams.pairIndices[portalIndex];
+	auto& translation = portalStreams.translations[portalIndex];
 
-bool visible(Portal& portal, Node& node) {
-	if (node.room == portal.mesh.room && portal.pairIndex != node.portalIndex)
-		return true;
-	else
-		return false;
-}
+	std::vector<glm::vec3> aperture, points, exits;
+	std::vector<glm::vec4> planes;
+	portalPoints(portalIndex, translation, aperture);
 
-void drawMesh(Mesh& mesh) {
-	glBindTexture(GL_TEXTURE_2D, textures.at(mesh.textureIndex).texture);
-	glDrawElementsBaseVertex(GL_TRIANGLES, mesh.indexLength, GL_UNSIGNED_SHORT, (GLvoid*)(mesh.indexOffset * sizeof(GLushort)), mesh.vertexOffset);
-}
+	auto center = 0.5f * (portal.mesh.minBorders + portal.mesh.maxBorders) + translation;
+	glm::vec4 sides[2] = { glm::vec4{ -portal.direction, glm::dot(portal.direction, center) }, glm::vec4{ portal.direction, -glm::dot(portal.direction, center) } };
 
-void drawNodeView(uint8_t nodeIndex) {
-	auto& node = nodes.at(nodeIndex);
-	uint8_t mod = node.layer % 2;
+	sideSets.clear();
+	sequenceSets.clear();
 
-	glClear(GL_DEPTH_BUFFER_BIT);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+	std::vector<uint32_t> sidePositions[2];
 
-	if (!mod) {
-		uint8_t value = nodeIndex;
+	for (auto position = portalStreams.roomOffsets[room]; position < portalStreams.roomOffsets[room + 1]; position++) {
+		auto index = portalStreams.roomPortals[position];
+		auto& sequence = sequenceSets.emplace_back();
 
-		glStencilFunc(GL_EQUAL, value, 0x0F);
-		glStencilMask(0xF0);
-	}
+		if (static_cast<int32_t>(index) == pairIndex)
+			continue;
 
-	else {
-		uint8_t value = nodeIndex << 4;
+		portalPoints(index, glm::vec3{ 0.0f }, points);
 
-		glStencilFunc(GL_EQUAL, value, 0xF0);
-		glStencilMask(0x0F);
-	}
+		auto seen = false;
 
-	for (auto& mesh : meshes)
-		if (node.room == mesh.room)
-			drawMesh(mesh);
+		for (auto side = 0u; side < 2; side++)
+			if (beyondPlane(sides[side], points)) {
+				sidePositions[side].push_back(position);
+				seen = true;
+			}
 
-	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+		if (!seen)
+			continue;
 
-	for (uint8_t childIndex = nodeIndex + 1; childIndex < nodes.size(); childIndex++) {
-		auto& childNode = nodes.at(childIndex);
-		auto& portal = portals.at(childNode.portalIndex);
+		planes.clear();
+		separatingPlanes(aperture, points, false, planes);
+		separatingPlanes(points, aperture, true, planes);
 
-		if (nodeIndex == childNode.parentIndex && portal.targetRoom == childNode.room) {
-			if (!mod) {
-				uint8_t value = (childIndex << 4) + nodeIndex;
+		// Past the exit itself only its far side is reachable, unless the aperture straddles its plane
+		auto& exit = portals.at(index);
+		auto exitCenter = 0.5f * (exit.mesh.minBorders + exit.mesh.maxBorders);
+		auto exitPlane = glm::vec4{ exit.direction, -glm::dot(exit.direction, exitCenter) };
 
-				glStencilFunc(GL_EQUAL, value, 0x0F);
-				glStencilMask(0xF0);
-			}
+		if (behindPlane(exitPlane, aperture))
+			planes.push_back(exitPlane);
+		else if (behindPlane(-exitPlane, aperture))
+			planes.push_back(-exitPlane);
 
-			else {
-				uint8_t value = (nodeIndex << 4) + childIndex;
+		auto exitRoom = portalStreams.targetRooms[index];
+		auto exitPair = portalStreams.pairIndices[index];
 
-				glStencilFunc(GL_EQUAL, value, 0xF0);
-				glStencilMask(0x0F);
-			}
+		for (auto next = portalStreams.roomOffsets[exitRoom]; next < portalStreams.roomOffsets[exitRoom + 1]; next++) {
+			auto nextIndex = portalStreams.roomPortals[next];
+
+			if (static_cast<int32_t>(nextIndex) == exitPair)
+				continue;
+
+			portalPoints(nextIndex, -portalStreams.translations[index], exits);
 
-			drawMesh(portal.mesh);
+			if (std::none_of(planes.begin(), planes.end(), [&](const glm::vec4& plane) { return behindPlane(plane, exits); }))
+				sequence.push_back(next);
 		}
 	}
-}
-
-void updateFeedbacks() {
-	if (checkPoint > 1.0) {
-		totalFrameCount += frameCount;
-		auto title = std::to_string(frameCount) + " - " + std::to_string(totalFrameCount);
 
-		frameCount = 0;
-		checkPoint = 0.0;
-		glfwSetWindowTitle(window, title.c_str());
+	for (auto& positions : sidePositions) {
+		sideSets.push_back(static_cast<uint32_t>(positions.size()));
+		sideSets.insert(sideSets.end(), positions.begin(), positions.end());
 	}
 }
 
-void draw() {
-	float Yaw = 0;
-	//float Yaw = glm::pi<float>();
+void compileVisibility() {
+	auto& visibility = portalVisibility;
+	auto portalTotal = static_cast<uint32_t>(portals.size());
 
-	while (true) {
-		glfwPollEvents();
+	visibility.sequenceBases.assign(portalTotal + 1, 0);
+
+	for (auto index = 0u; index < portalTotal; index++) {
+		auto room = portalStreams.targetRooms[index];
+		visibility.sequenceBases[index + 1] = visibility.sequenceBases[index] + portalStreams.roomOffsets[room + 1] - portalStreams.roomOffsets[room];
+	}
+
+	std::vector<std::vector<uint32_t>> sideSets(portalTotal);
+	std::vector<std::vector<std::vector<uint32_t>>> sequenceSets(portalTotal);
+
+	parallelFor(portalTotal, 1, [&](uint32_t first, uint32_t last) {
+		for (auto index = first; index < last; index++)
+			visiblePortals(index, sideSets[index], sequenceSets[index]);
+	});
+
+	visibility.setOffsets.assign(1, 0);
+	visibility.setPositions.clear();
+
+	auto appendSet = [&](auto first, auto last) {
+		visibility.setPositions.insert(visibility.setPositions.end(), first, last);
+		visibility.setOffsets.push_back(static_cast<uint32_t>(visibility.setPositions.size()));
+	};
+
+	for (auto room = 0u; room < roomCapacity; room++) {
+		for (auto position = portalStreams.roomOffsets[room]; position < portalStreams.roomOffsets[room + 1]; position++)
+			visibility.setPositions.push_back(position);
+
+		visibility.setOffsets.push_back(static_cast<uint32_t>(visibility.setPositions.size()));
+	}
+
+	for (auto& sets : sideSets) {
+		auto front = sets.begin();
+		auto back = front + 1 + *front;
+
+		appendSet(front + 1, back);
+		appendSet(back + 1, sets.end());
+	}
+
+	for (auto& sets : sequenceSets)
+		for (auto& set : sets)
+			appendSet(set.begin(), set.end());
+
+	std::cout << "Visibility: " << visibility.setOffsets.size() - 1 << " candidate sets, " << visibility.setPositions.size() << " entries" << std::endl;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void appendQuad(Geometry& geometry, const glm::vec3& corner, const glm::vec3& edgeU, const glm::vec3& edgeV) {
+	auto base = static_cast<GLushort>(geometry.positions.size());
+	auto normal = glm::normalize(glm::cross(edgeU, edgeV));
+	auto lengthU = glm::length(edgeU) / 2.0f, lengthV = glm::length(edgeV) / 2.0f;
+
+	geometry.positions.insert(geometry.positions.end(), { corner, corner + edgeU, corner + edgeU + edgeV, corner + edgeV });
+	geometry.normals.insert(geometry.normals.end(), { normal, normal, normal, normal });
+	geometry.texcoords.insert(geometry.texcoords.end(), { { 0.0f, 0.0f }, { lengthU, 0.0f }, { lengthU, lengthV }, { 0.0f, lengthV } });
+	geometry.indices.insert(geometry.indices.end(), { base, GLushort(base + 1), GLushort(base + 2), base, GLushort(base + 2), GLushort(base + 3) });
+}
+
+void appendBox(Geometry& geometry, const glm::vec3& min, const glm::vec3& max, bool inward) {
+	auto size = max - min;
+	glm::vec3 x{ size.x, 0.0f, 0.0f }, y{ 0.0f, size.y, 0.0f }, z{ 0.0f, 0.0f, size.z };
+
+	if (inward) {
+		appendQuad(geometry, min, z, x);
+		appendQuad(geometry, min, x, y);
+		appendQuad(geometry, min + z + x, -x, y);
+		appendQuad(geometry, min + z, -z, y);
+		appendQuad(geometry, min + x, z, y);
+	}
+
+	else {
+		appendQuad(geometry, min, x, z);
+		appendQuad(geometry, min + y, z, x);
+		appendQuad(geometry, min + x, -x, y);
+		appendQuad(geometry, min + z, x, y);
+		appendQuad(geometry, min, z, y);
+		appendQuad(geometry, min + x + z, -z, y);
+	}
+}
+
+int32_t appendBufferView(tinygltf::Model& model, const void* data, size_t length, int32_t target) {
+	auto& buffer = model.buffers.front();
+	auto offset = buffer.data.size();
+
+	buffer.data.resize(offset + ((length + 3) & ~size_t(3)));
+	std::memcpy(buffer.data.data() + offset, data, length);
+
+	tinygltf::BufferView view;
+	view.buffer = 0;
+	view.byteOffset = offset;
+	view.byteLength = length;
+	view.target = target;
+
+	model.bufferViews.push_back(view);
+	return static_cast<int32_t>(model.bufferViews.size() - 1);
+}
+
+int32_t appendAccessor(tinygltf::Model& model, const void* data, size_t count, size_t stride, int32_t componentType, int32_t type, int32_t target) {
+	tinygltf::Accessor accessor;
+	accessor.bufferView = appendBufferView(model, data, count * stride, target);
+	accessor.componentType = componentType;
+	accessor.count = count;
+	accessor.type = type;
+
+	model.accessors.push_back(accessor);
+	return static_cast<int32_t>(model.accessors.size() - 1);
+}
+
+void appendNode(tinygltf::Model& model, const Geometry& geometry, uint32_t textureIndex, const glm::vec3& translation, bool reversed) {
+	tinygltf::Primitive primitive;
+	primitive.mode = TINYGLTF_MODE_TRIANGLES;
+	primitive.material = textureIndex;
+	primitive.indices = appendAccessor(model, geometry.indices.data(), geometry.indices.size(), sizeof(GLushort),
+		TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, TINYGLTF_TYPE_SCALAR, TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER);
+	primitive.attributes["POSITION"] = appendAccessor(model, geometry.positions.data(), geometry.positions.size(), sizeof(glm::vec3),
+		TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3, TINYGLTF_TARGET_ARRAY_BUFFER);
+	primitive.attributes["NORMAL"] = appendAccessor(model, geometry.normals.data(), geometry.normals.size(), sizeof(glm::vec3),
+		TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3, TINYGLTF_TARGET_ARRAY_BUFFER);
+	primitive.attributes["TEXCOORD_0"] = appendAccessor(model, geometry.texcoords.data(), geometry.texcoords.size(), sizeof(glm::vec2),
+		TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC2, TINYGLTF_TARGET_ARRAY_BUFFER);
+
+	auto min = glm::vec3{ std::numeric_limits<float_t>::max() }, max = glm::vec3{ -std::numeric_limits<float_t>::max() };
+
+	for (auto& position : geometry.positions) {
+		min = glm::min(min, position);
+		max = glm::max(max, position);
+	}
+
+	auto& positionAccessor = model.accessors.at(primitive.attributes["POSITION"]);
+	positionAccessor.minValues = { min.x, min.y, min.z };
+	positionAccessor.maxValues = { max.x, max.y, max.z };
+
+	tinygltf::Mesh mesh;
+	mesh.primitives.push_back(primitive);
+	model.meshes.push_back(mesh);
+
+	tinygltf::Node node;
+	node.mesh = static_cast<int32_t>(model.meshes.size() - 1);
+	node.translation = { translation.x, translation.y, translation.z };
+
+	if (reversed)
+		node.rotation = { 0.0, 1.0, 0.0, 0.0 };
+
+	model.nodes.push_back(node);
+	model.scenes.front().nodes.push_back(static_cast<int32_t>(model.nodes.size() - 1));
+}
+
+tinygltf::Model createModel(const std::string name, uint32_t textureCount) {
+	tinygltf::Model model;
+
+	model.asset.version = "2.0";
+	model.asset.generator = "Hilda";
+	model.defaultScene = 0;
+	model.scenes.resize(1);
+	model.buffers.resize(1);
+	model.buffers.front().uri = name + ".bin";
+
+	for (auto index = 0u; index < textureCount; index++) {
+		tinygltf::Image image;
+		image.name = "t" + std::to_string(index);
+		image.uri = image.name + ".jpg";
+		image.mimeType = "image/jpeg";
+		model.images.push_back(image);
+
+		tinygltf::Texture texture;
+		texture.source = index;
+		model.textures.push_back(texture);
+
+		tinygltf::Material material;
+		material.name = image.name;
+		material.pbrMetallicRoughness.baseColorTexture.index = index;
+		model.materials.push_back(material);
+	}
+
+	return model;
+}
+
+void writeModel(tinygltf::Model& model, const std::string folder, const std::string name) {
+	if (model.buffers.front().data.empty())
+		model.buffers.clear();
+
+	objectLoader.WriteGltfSceneToFile(&model, folder + name + ".gltf", false, false, true, false);
+}
+
+void generateScene(const std::string folder, uint32_t roomCount, uint32_t branchFactor, uint32_t propCount, uint32_t textureCount) {
+	std::mt19937 generator{ 0 };
+	std::uniform_real_distribution<float_t> unit{ 0.0f, 1.0f };
+	std::uniform_int_distribution<uint32_t> color{ 32, 224 };
+
+	roomCount = std::clamp(roomCount, 1u, 254u);
+	branchFactor = std::max(branchFactor, 1u);
+	textureCount = std::max(textureCount, 1u);
+
+	std::filesystem::create_directories(folder);
+	std::ofstream manifest(folder + "scene.txt");
+
+	objectLoader.SetImageWriter([](const std::string*, const std::string*, tinygltf::Image*, bool, void*) { return true; }, nullptr);
+
+	for (auto index = 0u; index < textureCount; index++) {
+		constexpr auto size = 64u, tile = 8u;
+		std::vector<uint8_t> pixels(size * size * 3);
+		uint8_t first[3] = { uint8_t(color(generator)), uint8_t(color(generator)), uint8_t(color(generator)) };
+
+		for (auto pixel = 0u; pixel < size * size; pixel++)
+			for (auto channel = 0u; channel < 3; channel++)
+				pixels.at(pixel * 3 + channel) = ((pixel % size / tile + pixel / size / tile) % 2) ? first[channel] : first[channel] / 2;
+
+		stbi_write_jpg((folder + "t" + std::to_string(index) + ".jpg").c_str(), size, size, 3, pixels.data(), 90);
+	}
+
+	// Rooms form a tree, room c is entered from room (c - 2) / branchFactor + 1 through slot (c - 2) % branchFactor.
+	// Portal rows alternate with depth so that the entrance of a room never shares a slot with its exits.
+	auto roomWidth = 4.0f * branchFactor + 4.0f, roomDepth = 16.0f, roomHeight = 3.0f;
+	auto roomOffset = [&](uint32_t room) { return glm::vec3{ room * (roomWidth + 16.0f), 0.0f, 0.0f }; };
+	std::vector<uint32_t> depths(roomCount + 1, 0);
+
+	{
+		tinygltf::Model model = createModel("c", 0);
+		tinygltf::Node node;
+		auto position = roomOffset(1) + glm::vec3{ roomWidth / 2.0f, 0.0f, 7.5f };
+
+		node.translation = { position.x, position.y, position.z };
+		model.nodes.push_back(node);
+		model.scenes.front().nodes.push_back(0);
+
+		writeModel(model, folder, "c");
+		manifest << "camera c 1" << std::endl;
+	}
+
+	Geometry portalGeometry;
+	appendQuad(portalGeometry, { -0.75f, 0.0f, 0.0f }, { 1.5f, 0.0f, 0.0f }, { 0.0f, 2.2f, 0.0f });
+
+	for (auto room = 2u; room <= roomCount; room++) {
+		auto parent = (room - 2) / branchFactor + 1;
+		auto slot = (room - 2) % branchFactor;
+		depths.at(room) = depths.at(parent) + 1;
+
+		glm::vec3 local{ 4.0f + 4.0f * slot, 0.0f, depths.at(parent) % 2 ? 10.0f : 5.0f };
+
+		auto blueName = "p" + std::to_string(parent) + "_" + std::to_string(room);
+		auto orangeName = "p" + std::to_string(room) + "_" + std::to_string(parent);
+
+		tinygltf::Model blueModel = createModel(blueName, textureCount);
+		appendNode(blueModel, portalGeometry, 0, roomOffset(parent) + local, false);
+		writeModel(blueModel, folder, blueName);
+
+		tinygltf::Model orangeModel = createModel(orangeName, textureCount);
+		appendNode(orangeModel, portalGeometry, 0, roomOffset(room) + local, true);
+		writeModel(orangeModel, folder, orangeName);
+
+		manifest << "portal " << blueName << " " << parent << std::endl;
+		manifest << "portal " << orangeName << " " << room << std::endl;
+	}
+
+	for (auto room = 1u; room <= roomCount; room++) {
+		auto name = "r" + std::to_string(room);
+		auto roomProps = propCount / roomCount + (room - 1 < propCount % roomCount ? 1 : 0);
+
+		tinygltf::Model model = createModel(name, textureCount);
+
+		Geometry shell;
+		appendBox(shell, glm::vec3{ 0.0f }, glm::vec3{ roomWidth, roomHeight, roomDepth }, true);
+		appendNode(model, shell, room % textureCount, roomOffset(room), false);
+
+		for (auto prop = 0u; prop < roomProps; prop++) {
+			auto size = 0.2f + 0.4f * unit(generator);
+			glm::vec3 position{ 0.5f + (roomWidth - 1.0f - size) * unit(generator), 0.0f, 12.0f + (roomDepth - 12.5f - size) * unit(generator) };
+
+			Geometry box;
+			appendBox(box, glm::vec3{ 0.0f }, glm::vec3{ size }, false);
+			appendNode(model, box, generator() % textureCount, roomOffset(room) + position, false);
+		}
+
+		writeModel(model, folder, name);
+		manifest << "mesh " << name << " " << room << std::endl;
+	}
+
+	std::cout << "Generated " << roomCount << " rooms, " << 2 * (roomCount - 1) << " portals, " << propCount << " props and "
+		<< textureCount << " textures in " << folder << std::endl;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+std::string readShaderSource(std::string path)
+{
+	std::ifstream file;
+	file.open((shaderFolder + path).c_str());
+	std::stringstream stream;
+	stream << file.rdbuf();
+	file.close();
+
+	return stream.str();
+}
+
+std::vector<char> readShaderBinary(std::string path)
+{
+	std::ifstream file(shaderFolder + path, std::ios::binary);
+	return std::vector<char>{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+}
+
+void createMockHiddenArea(std::vector<glm::vec2>& hiddenVertices) {
+	for (auto segment = 0u; segment < hiddenAreaSegments; segment++) {
+		glm::vec2 inner[2], outer[2];
+
+		for (auto side = 0u; side < 2; side++) {
+			auto angle = glm::two_pi<float_t>() * (segment + side) / hiddenAreaSegments;
+			glm::vec2 direction{ std::cos(angle), std::sin(angle) };
+
+			inner[side] = 0.5f + 0.5f * direction;
+			outer[side] = 0.5f + 0.5f * direction / std::max(std::abs(direction.x), std::abs(direction.y));
+		}
+
+		hiddenVertices.insert(hiddenVertices.end(), { inner[0], outer[0], outer[1], inner[0], outer[1], inner[1] });
+	}
+}
+
+std::vector<glm::vec2> hiddenAreaVertices() {
+	std::vector<glm::vec2> hiddenVertices;
+
+	for (int eye = 0; eye < 2; eye++) {
+		auto& hiddenArea = hiddenAreas[eye];
+		hiddenArea.first = static_cast<GLint>(hiddenVertices.size());
+
+		ovrFovStencilDesc stencilDesc{};
+		stencilDesc.StencilType = ovrFovStencil_HiddenArea;
+		stencilDesc.StencilFlags = ovrFovStencilFlag_MeshOriginAtBottomLeft;
+		stencilDesc.Eye = ovrEyeType(eye);
+		stencilDesc.FovPort = hmdDesc.DefaultEyeFov[eye];
+		stencilDesc.HmdToEyeRotation = eyeRenderDesc[eye].HmdToEyePose.Orientation;
+
+		ovrFovStencilMeshBuffer meshBuffer{};
+		auto result = session ? ovr_GetFovStencil(session, &stencilDesc, &meshBuffer) : ovrError_NoHmd;
+
+		if (OVR_SUCCESS(result) && meshBuffer.UsedIndexCount) {
+			std::vector<ovrVector2f> stencilVertices(meshBuffer.UsedVertexCount);
+			std::vector<uint16_t> stencilIndices(meshBuffer.UsedIndexCount);
+
+			meshBuffer.AllocVertexCount = meshBuffer.UsedVertexCount;
+			meshBuffer.AllocIndexCount = meshBuffer.UsedIndexCount;
+			meshBuffer.VertexBuffer = stencilVertices.data();
+			meshBuffer.IndexBuffer = stencilIndices.data();
+
+			result = ovr_GetFovStencil(session, &stencilDesc, &meshBuffer);
+
+			for (auto index = 0; OVR_SUCCESS(result) && index < meshBuffer.UsedIndexCount; index++) {
+				auto& vertex = stencilVertices.at(stencilIndices.at(index));
+				hiddenVertices.push_back({ vertex.x, vertex.y });
+			}
+		}
+
+		if (OVR_FAILURE(result) || hiddenVertices.size() == static_cast<size_t>(hiddenArea.first)) {
+			hiddenVertices.resize(hiddenArea.first);
+			createMockHiddenArea(hiddenVertices);
+		}
+
+		hiddenArea.count = static_cast<GLsizei>(hiddenVertices.size() - hiddenArea.first);
+	}
+
+	return hiddenVertices;
+}
+
+void createWindow() {
+	window = glfwCreateWindow(width, height, "", nullptr, nullptr);
+
+	glfwSetKeyCallback(window, keyboardCallback);
+	glfwSetFramebufferSizeCallback(window, resizeEvent);
+}
+
+void setupHeadless() {
+	// Rift CV1 figures stand in for the headset, headless runs never load the runtime
+	hmdDesc = {};
+	hmdDesc.Type = ovrHmd_CV1;
+	hmdDesc.Resolution = { 2160, 1200 };
+	hmdDesc.DisplayRefreshRate = 90.0f;
+
+	for (int eye = 0; eye < 2; eye++) {
+		hmdDesc.DefaultEyeFov[eye] = { 1.33f, 1.33f, eye ? 1.09f : 1.06f, eye ? 1.06f : 1.09f };
+		hmdDesc.MaxEyeFov[eye] = hmdDesc.DefaultEyeFov[eye];
+
+		eyeRenderDesc[eye] = {};
+		eyeRenderDesc[eye].Eye = ovrEyeType(eye);
+		eyeRenderDesc[eye].Fov = hmdDesc.DefaultEyeFov[eye];
+		eyeRenderDesc[eye].HmdToEyePose.Orientation.w = 1.0f;
+		eyeRenderDesc[eye].HmdToEyePose.Position.x = eye ? 0.032f : -0.032f;
+	}
+}
+
+void setup() {
+	if (headless)
+		setupHeadless();
+	else {
+		ovr_Initialize(nullptr);
+		ovr_Create(&session, &luid);
+
+		hmdDesc = ovr_GetHmdDesc(session);
+
+		for (int eye = 0; eye < 2; eye++)
+			eyeRenderDesc[eye] = ovr_GetRenderDesc(session, ovrEyeType(eye), hmdDesc.DefaultEyeFov[eye]);
+	}
+
+	width = hmdDesc.Resolution.w / 2;
+	height = hmdDesc.Resolution.h / 2;
+
+	nodeLimit = 15;	// 2 ^ 4 - 1 - 1
+
+	yaw = 0.0f;
+	//yaw = glm::pi<float>();
+
+	currentImage = 0;
+	frameCount = 0;
+	frameIndex = 0;
+
+	if (capturePath.empty())
+		captureFrame = -1;
+	totalFrameCount = 0;
+	timeDelta = 0.0;
+	checkPoint = 0.0;
+	totalTime = 0.0;
+
+	shaderFolder = "Shaders/";
+	cacheFolder = "Cache/";
+
+	renderer->setup();
+
+	setupJobs();
+
+	for (auto& log : traversalLogs)
+		log.reserve(traversalLogCapacity);
+	createScene();
+	compileScene();
+	compileVisibility();
+
+	for (auto& packet : renderQueue.slots)
+		for (int eye = 0; eye < 2; eye++) {
+			packet.drawLists[eye].allocate(static_cast<uint32_t>(meshes.size() * nodeCapacity));
+			packet.commandLists[eye].allocate(static_cast<uint32_t>((meshes.size() + 12 + 2 * nodeCapacity) * nodeCapacity));
+		}
+
+	std::cout << "Scene: " << textures.size() << " textures, " << meshCount << " meshes, " << portalCount << " portals, "
+		<< vertices.size() << " vertices, " << indices.size() << " indices" << std::endl;
+
+	setupProfiler();
+	setupPoseRecording();
+	setupResolutionScaling();
+
+	for (int eye = 0; eye < 2; eye++) {
+		auto& framebuffer = framebuffers[eye];
+
+		// Swapchains are allocated at the highest density, scaling moves the viewport inside them
+		ovrSizei idealTextureSize = session ? ovr_GetFovTextureSize(session, ovrEyeType(eye), hmdDesc.DefaultEyeFov[eye], maximumPixelDensity) :
+			ovrSizei{ static_cast<int>(headlessTextureWidth * maximumPixelDensity), static_cast<int>(headlessTextureHeight * maximumPixelDensity) };
+
+		framebuffer.width = idealTextureSize.w;
+		framebuffer.height = idealTextureSize.h;
+		framebuffer.viewportWidth = std::max(1u, static_cast<uint32_t>(framebuffer.width * resolutionScale));
+		framebuffer.viewportHeight = std::max(1u, static_cast<uint32_t>(framebuffer.height * resolutionScale));
+	}
+
+	if (session)
+		ovr_SetTrackingOriginType(session, ovrTrackingOrigin_FloorLevel);
+
+	renderer->setupScene();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool visible(uint32_t portalIndex, const Node& node) {
+	if (portalStreams.pairIndices[portalIndex] != node.portalIndex)
+		return true;
+	else
+		return false;
+}
+
+uint32_t recordNodeView(const RenderPacket& packet, int eye, uint8_t nodeIndex, RenderCommand* commands) {
+	auto& eyeNodes = packet.nodes[eye];
+	auto& node = eyeNodes.at(nodeIndex);
+	uint8_t mod = node.layer % 2;
+	auto count = 0u;
+
+	auto record = [&](Command type, uint32_t first = 0, uint32_t second = 0, uint32_t third = 0, uint32_t fourth = 0) {
+		commands[count++] = RenderCommand{ type, { first, second, third, fourth } };
+	};
+
+	// Nodes whose portal mark passed no samples are discarded along with their subtree
+	if (nodeIndex)
+		record(Command::BeginConditional, nodeIndex);
+
+	record(Command::ClearDepth);
+	record(Command::StencilReplace, false);
+	record(Command::Stencil, false, 0x00, 0xFF, 0x00);
+	record(Command::HiddenArea);
+
+	if (!mod)
+		record(Command::Stencil, true, nodeIndex, 0x0F, 0xF0);
+	else
+		record(Command::Stencil, true, nodeIndex << 4, 0xF0, 0x0F);
+
+	auto& drawList = packet.drawLists[eye];
+
+	if (gpuCulling)
+		record(Command::DrawCulled, nodeIndex);
+
+	else
+		for (auto index = node.drawOffset; index < node.drawOffset + node.drawCount; index++)
+			record(Command::DrawMesh, drawList[index]);
+
+	record(Command::StencilReplace, true);
+
+	auto masking = false;
+
+	for (uint8_t childIndex = nodeIndex + 1; childIndex < eyeNodes.size(); childIndex++) {
+		auto& childNode = eyeNodes.at(childIndex);
+
+		if (nodeIndex == childNode.parentIndex && portalStreams.targetRooms[childNode.portalIndex] == childNode.room) {
+			if (!mod)
+				record(Command::Stencil, true, (childIndex << 4) + nodeIndex, 0x0F, 0xF0);
+			else
+				record(Command::Stencil, true, (nodeIndex << 4) + childIndex, 0xF0, 0x0F);
+
+			if (!masking) {
+				record(Command::BeginMask);
+				masking = true;
+			}
+
+			record(Command::DrawMask, childNode.portalIndex, childIndex);
+		}
+	}
+
+	if (masking)
+		record(Command::EndMask);
+
+	if (nodeIndex)
+		record(Command::EndConditional);
+
+	return count;
+}
+
+uint32_t nodeCommandLimit(const FixedVector<Node, nodeCapacity>& eyeNodes, const Node& node) {
+	return 12 + (gpuCulling ? 1 : node.drawCount) + 2 * eyeNodes.size();
+}
+
+void recordEye(RenderPacket& packet, int eye) {
+	auto& eyeNodes = packet.nodes[eye];
+	auto& commandList = packet.commandLists[eye];
+	auto offset = 0u;
+
+	for (auto& node : eyeNodes) {
+		node.commandOffset = offset;
+		offset += nodeCommandLimit(eyeNodes, node);
+	}
+
+	commandList.resize(offset);
+
+	parallelFor(eyeNodes.size(), 1, [&](uint32_t first, uint32_t last) {
+		for (auto index = first; index < last; index++) {
+			auto& node = eyeNodes.at(index);
+			node.commandCount = recordNodeView(packet, eye, index, commandList.data() + node.commandOffset);
+		}
+	});
+}
+
+void updateFeedbacks() {
+	if (checkPoint > 1.0) {
+		totalFrameCount += frameCount;
+		char title[32];
+		std::snprintf(title, sizeof(title), "%u - %u", frameCount, totalFrameCount);
+
+		frameCount = 0;
+		checkPoint = 0.0;
+
+		if (window)
+			glfwSetWindowTitle(window, title);
+	}
+}
+
+void samplePoses(PoseRecord& record) {
+	if (!session) {
+		for (int eye = 0; eye < 2; eye++) {
+			record.eyePoses[eye] = eyeRenderDesc[eye].HmdToEyePose;
+			record.eyePoses[eye].Position.y += OVR_DEFAULT_EYE_HEIGHT;
+		}
+
+		return;
+	}
+
+	ovrPosef hmdToEyePoses[2];
+
+	for (int eye = 0; eye < 2; eye++) {
+		eyeRenderDesc[eye] = ovr_GetRenderDesc(session, ovrEyeType(eye), hmdDesc.DefaultEyeFov[eye]);
+		hmdToEyePoses[eye] = eyeRenderDesc[eye].HmdToEyePose;
+	}
+
+	// The compositor measures latency from this time, so it is taken right before tracking is sampled
+	auto displayTime = ovr_GetPredictedDisplayTime(session, frameIndex);
+	record.sensorSampleTime = ovr_GetTimeInSeconds();
+	auto trackingState = ovr_GetTrackingState(session, displayTime, ovrTrue);
+
+	ovr_CalcEyePoses(trackingState.HeadPose.ThePose, hmdToEyePoses, record.eyePoses);
+}
+
+void crossScalar(const glm::vec3& previousPosition, const glm::vec3& direction, float_t distance, uint32_t position,
+	int32_t& crossing, float_t& coefficient) {
+	auto& bounds = portalBounds;
+	auto denominator = direction.x * bounds.normalX[position] + direction.y * bounds.normalY[position] + direction.z * bounds.normalZ[position];
+
+	if (std::abs(denominator) <= std::numeric_limits<float_t>::epsilon())
+		return;
+
+	auto numerator = (bounds.originX[position] - previousPosition.x) * bounds.normalX[position] +
+		(bounds.originY[position] - previousPosition.y) * bounds.normalY[position] +
+		(bounds.originZ[position] - previousPosition.z) * bounds.normalZ[position];
+	auto distanceAlong = numerator / denominator;
+
+	if (distanceAlong <= 0.0f || distanceAlong > distance || distanceAlong >= coefficient)
+		return;
+
+	auto point = previousPosition + distanceAlong * direction;
+
+	if (point.x >= bounds.minX[position] && point.y >= bounds.minY[position] && point.z >= bounds.minZ[position] &&
+		point.x <= bounds.maxX[position] && point.y <= bounds.maxY[position] && point.z <= bounds.maxZ[position]) {
+		crossing = static_cast<int32_t>(position);
+		coefficient = distanceAlong;
+	}
+}
+
+#if defined(__AVX__)
+void crossBatch(const glm::vec3& previousPosition, const glm::vec3& direction, float_t distance, uint32_t& position, uint32_t last,
+	int32_t& crossing, float_t& coefficient) {
+	auto& bounds = portalBounds;
+
+	auto positionX = _mm256_set1_ps(previousPosition.x), positionY = _mm256_set1_ps(previousPosition.y), positionZ = _mm256_set1_ps(previousPosition.z);
+	auto directionX = _mm256_set1_ps(direction.x), directionY = _mm256_set1_ps(direction.y), directionZ = _mm256_set1_ps(direction.z);
+	auto limit = _mm256_set1_ps(distance), zero = _mm256_setzero_ps(), sign = _mm256_set1_ps(-0.0f);
+	auto parallel = _mm256_set1_ps(std::numeric_limits<float_t>::epsilon());
+
+	for (; position + 8 <= last; position += 8) {
+		auto normalX = _mm256_loadu_ps(&bounds.normalX[position]), normalY = _mm256_loadu_ps(&bounds.normalY[position]), normalZ = _mm256_loadu_ps(&bounds.normalZ[position]);
+
+		auto denominator = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(directionX, normalX), _mm256_mul_ps(directionY, normalY)), _mm256_mul_ps(directionZ, normalZ));
+		auto numerator = _mm256_add_ps(_mm256_add_ps(
+			_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&bounds.originX[position]), positionX), normalX),
+			_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&bounds.originY[position]), positionY), normalY)),
+			_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&bounds.originZ[position]), positionZ), normalZ));
+		auto distanceAlong = _mm256_div_ps(numerator, denominator);
+
+		auto mask = _mm256_and_ps(_mm256_cmp_ps(_mm256_andnot_ps(sign, denominator), parallel, _CMP_GT_OQ),
+			_mm256_and_ps(_mm256_cmp_ps(distanceAlong, zero, _CMP_GT_OQ), _mm256_cmp_ps(distanceAlong, limit, _CMP_LE_OQ)));
+
+		auto pointX = _mm256_add_ps(positionX, _mm256_mul_ps(distanceAlong, directionX));
+		auto pointY = _mm256_add_ps(positionY, _mm256_mul_ps(distanceAlong, directionY));
+		auto pointZ = _mm256_add_ps(positionZ, _mm256_mul_ps(distanceAlong, directionZ));
+
+		mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(pointX, _mm256_loadu_ps(&bounds.minX[position]), _CMP_GE_OQ), _mm256_cmp_ps(pointX, _mm256_loadu_ps(&bounds.maxX[position]), _CMP_LE_OQ)));
+		mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(pointY, _mm256_loadu_ps(&bounds.minY[position]), _CMP_GE_OQ), _mm256_cmp_ps(pointY, _mm256_loadu_ps(&bounds.maxY[position]), _CMP_LE_OQ)));
+		mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(pointZ, _mm256_loadu_ps(&bounds.minZ[position]), _CMP_GE_OQ), _mm256_cmp_ps(pointZ, _mm256_loadu_ps(&bounds.maxZ[position]), _CMP_LE_OQ)));
+
+		auto hits = _mm256_movemask_ps(mask);
+
+		if (!hits)
+			continue;
+
+		alignas(32) float_t lanes[8];
+		_mm256_store_ps(lanes, distanceAlong);
+
+		for (auto lane = 0u; lane < 8; lane++)
+			if ((hits & (1 << lane)) && lanes[lane] < coefficient) {
+				crossing = static_cast<int32_t>(position + lane);
+				coefficient = lanes[lane];
+			}
+	}
+}
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+void crossBatch(const glm::vec3& previousPosition, const glm::vec3& direction, float_t distance, uint32_t& position, uint32_t last,
+	int32_t& crossing, float_t& coefficient) {
+	auto& bounds = portalBounds;
+
+	auto positionX = _mm_set1_ps(previousPosition.x), positionY = _mm_set1_ps(previousPosition.y), positionZ = _mm_set1_ps(previousPosition.z);
+	auto directionX = _mm_set1_ps(direction.x), directionY = _mm_set1_ps(direction.y), directionZ = _mm_set1_ps(direction.z);
+	auto limit = _mm_set1_ps(distance), zero = _mm_setzero_ps(), sign = _mm_set1_ps(-0.0f);
+	auto parallel = _mm_set1_ps(std::numeric_limits<float_t>::epsilon());
+
+	for (; position + 4 <= last; position += 4) {
+		auto normalX = _mm_loadu_ps(&bounds.normalX[position]), normalY = _mm_loadu_ps(&bounds.normalY[position]), normalZ = _mm_loadu_ps(&bounds.normalZ[position]);
+
+		auto denominator = _mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, normalX), _mm_mul_ps(directionY, normalY)), _mm_mul_ps(directionZ, normalZ));
+		auto numerator = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&bounds.originX[position]), positionX), normalX),
+			_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&bounds.originY[position]), positionY), normalY)),
+			_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&bounds.originZ[position]), positionZ), normalZ));
+		auto distanceAlong = _mm_div_ps(numerator, denominator);
+
+		auto mask = _mm_and_ps(_mm_cmpgt_ps(_mm_andnot_ps(sign, denominator), parallel),
+			_mm_and_ps(_mm_cmpgt_ps(distanceAlong, zero), _mm_cmple_ps(distanceAlong, limit)));
+
+		auto pointX = _mm_add_ps(positionX, _mm_mul_ps(distanceAlong, directionX));
+		auto pointY = _mm_add_ps(positionY, _mm_mul_ps(distanceAlong, directionY));
+		auto pointZ = _mm_add_ps(positionZ, _mm_mul_ps(distanceAlong, directionZ));
+
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(pointX, _mm_loadu_ps(&bounds.minX[position])), _mm_cmple_ps(pointX, _mm_loadu_ps(&bounds.maxX[position]))));
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(pointY, _mm_loadu_ps(&bounds.minY[position])), _mm_cmple_ps(pointY, _mm_loadu_ps(&bounds.maxY[position]))));
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(pointZ, _mm_loadu_ps(&bounds.minZ[position])), _mm_cmple_ps(pointZ, _mm_loadu_ps(&bounds.maxZ[position]))));
+
+		auto hits = _mm_movemask_ps(mask);
+
+		if (!hits)
+			continue;
+
+		alignas(16) float_t lanes[4];
+		_mm_store_ps(lanes, distanceAlong);
+
+		for (auto lane = 0u; lane < 4; lane++)
+			if ((hits & (1 << lane)) && lanes[lane] < coefficient) {
+				crossing = static_cast<int32_t>(position + lane);
+				coefficient = lanes[lane];
+			}
+	}
+}
+#else
+void crossBatch(const glm::vec3& previousPosition, const glm::vec3& direction, float_t distance, uint32_t& position, uint32_t last,
+	int32_t& crossing, float_t& coefficient) {
+	static_cast<void>(previousPosition);
+	static_cast<void>(direction);
+	static_cast<void>(distance);
+	static_cast<void>(last);
+	static_cast<void>(crossing);
+	static_cast<void>(coefficient);
+	static_cast<void>(position);
+}
+#endif
+
+int32_t findCrossing(const glm::vec3& previousPosition, const glm::vec3& direction, float_t distance, uint32_t first, uint32_t last,
+	float_t& coefficient) {
+	// Returns the room-sorted position of the earliest crossing along the segment, ties go to the lower position
+	auto crossing = -1;
+	auto position = first;
+
+	coefficient = std::numeric_limits<float_t>::infinity();
+
+	crossBatch(previousPosition, direction, distance, position, last, crossing, coefficient);
+
+	for (; position < last; position++)
+		crossScalar(previousPosition, direction, distance, position, crossing, coefficient);
+
+	return crossing;
+}
+
+int32_t findFirstCrossing(const glm::vec3& previousPosition, const glm::vec3& direction, float_t distance, uint32_t first, uint32_t last) {
+	auto coefficient = 0.0f;
+
+	for (auto position = first; position < last; position++) {
+		auto& portal = portals.at(portalStreams.roomPortals[position]);
+
+		if (glm::intersectRayPlane(previousPosition, direction, portal.mesh.origin, portal.direction, coefficient)) {
+			auto point = previousPosition + coefficient * direction;
+
+			if (point.x >= portal.mesh.minBorders.x && point.y >= portal.mesh.minBorders.y && point.z >= portal.mesh.minBorders.z &&
+				point.x <= portal.mesh.maxBorders.x && point.y <= portal.mesh.maxBorders.y && point.z <= portal.mesh.maxBorders.z &&
+				0 <= coefficient && distance >= coefficient)
+				return static_cast<int32_t>(position);
+		}
+	}
+
+	return -1;
+}
+
+int32_t benchmarkCrossing(uint32_t count) {
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float_t> place(-64.0f, 64.0f), extent(0.5f, 4.0f), length(0.5f, 16.0f), unit(-1.0f, 1.0f);
+
+	portals.clear();
+
+	for (auto index = 0u; index < count; index++) {
+		Portal portal{};
+		glm::vec3 normal{};
+		normal[index % 3] = 1.0f;
+
+		portal.mesh.room = 0;
+		portal.mesh.origin = glm::vec3{ place(random), place(random), place(random) };
+		portal.direction = normal;
+
+		auto size = glm::vec3{ extent(random), extent(random), extent(random) } * (glm::vec3{ 1.0f } - normal);
+		portal.mesh.minBorders = portal.mesh.origin - size;
+		portal.mesh.maxBorders = portal.mesh.origin + size;
 
-		if (glfwWindowShouldClose(window))
-			break;
+		portals.push_back(portal);
+	}
 
-		ovrSessionStatus sessionStatus;
-		ovr_GetSessionStatus(session, &sessionStatus);
+	portalCount = count;
+	compileScene();
 
-		if (sessionStatus.ShouldQuit)
-			break;
+	constexpr auto segmentCount = 4096u;
+	std::vector<glm::vec3> starts(segmentCount), directions(segmentCount);
+	std::vector<float_t> distances(segmentCount);
 
-		if (sessionStatus.ShouldRecenter)
-			ovr_RecenterTrackingOrigin(session);
+	for (auto index = 0u; index < segmentCount; index++) {
+		starts.at(index) = glm::vec3{ place(random), place(random), place(random) };
+		directions.at(index) = glm::normalize(glm::vec3{ unit(random), unit(random), unit(random) });
+		distances.at(index) = length(random);
+	}
 
-		if (sessionStatus.IsVisible)
-		{
-			ovrEyeRenderDesc eyeRenderDesc[2];
-			eyeRenderDesc[0] = ovr_GetRenderDesc(session, ovrEye_Left, hmdDesc.DefaultEyeFov[0]);
-			eyeRenderDesc[1] = ovr_GetRenderDesc(session, ovrEye_Right, hmdDesc.DefaultEyeFov[1]);
+	auto loopHits = 0u, batchHits = 0u, mismatches = 0u;
+	auto loopStart = std::chrono::steady_clock::now();
+
+	for (auto index = 0u; index < segmentCount; index++)
+		loopHits += findFirstCrossing(starts.at(index), directions.at(index), distances.at(index), 0, count) >= 0;
+
+	auto batchStart = std::chrono::steady_clock::now();
+
+	for (auto index = 0u; index < segmentCount; index++) {
+		auto coefficient = 0.0f;
+		batchHits += findCrossing(starts.at(index), directions.at(index), distances.at(index), 0, count, coefficient) >= 0;
+	}
+
+	auto batchEnd = std::chrono::steady_clock::now();
+
+	for (auto index = 0u; index < segmentCount; index++) {
+		auto coefficient = 0.0f, scalarCoefficient = std::numeric_limits<float_t>::infinity();
+		auto crossing = findCrossing(starts.at(index), directions.at(index), distances.at(index), 0, count, coefficient);
+		auto scalarCrossing = -1;
+
+		for (auto position = 0u; position < count; position++)
+			crossScalar(starts.at(index), directions.at(index), distances.at(index), position, scalarCrossing, scalarCoefficient);
+
+		mismatches += crossing != scalarCrossing;
+	}
+
+	if (loopHits != batchHits)
+		mismatches++;
+
+	auto loopTime = std::chrono::duration<double_t, std::nano>(batchStart - loopStart).count();
+	auto batchTime = std::chrono::duration<double_t, std::nano>(batchEnd - batchStart).count();
+
+	std::cout << count << " portals, " << segmentCount << " segments, " << batchHits << " crossings, " << mismatches << " mismatches" << std::endl;
+	std::cout << "Loop: " << loopTime / segmentCount << " ns per segment, batched: " << batchTime / segmentCount << " ns per segment" << std::endl;
 
-			ovrPosef EyeRenderPose[2];
-			ovrPosef HmdToEyePose[2] = { eyeRenderDesc[0].HmdToEyePose, eyeRenderDesc[1].HmdToEyePose };
+	return mismatches ? 1 : 0;
+}
 
-			double sensorSampleTime;
-			ovr_GetEyePoses(session, frameCount, ovrTrue, HmdToEyePose, EyeRenderPose, &sensorSampleTime);
+glm::vec4 narrowWindow(const glm::vec4& window, const glm::mat3& basis, const glm::vec3& eyePosition, const glm::vec3& min, const glm::vec3& max) {
+	auto narrowed = glm::vec4{ std::numeric_limits<float_t>::max(), -std::numeric_limits<float_t>::max(),
+		std::numeric_limits<float_t>::max(), -std::numeric_limits<float_t>::max() };
+	auto behind = 0u;
 
-			ovrTimewarpProjectionDesc posTimewarpProjectionDesc = {};
+	for (auto corner = 0u; corner < 8; corner++) {
+		glm::vec3 point{ corner & 1 ? max.x : min.x, corner & 2 ? max.y : min.y, corner & 4 ? max.z : min.z };
+		auto view = glm::transpose(basis) * (point - eyePosition);
 
-			for (int eye = 0; eye < 2; eye++)
-			{
-				auto& framebuffer = framebuffers[eye];
-				auto& currentRoom = currentRooms[eye];
-				auto& previousPosition = previousPositions[eye];
-				auto& currentPosition = currentPositions[eye];
-				auto& currentTranslation = currentTranslations[eye];
+		if (-view.z <= epsilon) {
+			behind++;
+			continue;
+		}
 
-				GLuint curColorTexId;
-				GLuint curDepthTexId;
+		narrowed.x = std::min(narrowed.x, view.x / -view.z);
+		narrowed.y = std::max(narrowed.y, view.x / -view.z);
+		narrowed.z = std::min(narrowed.z, view.y / -view.z);
+		narrowed.w = std::max(narrowed.w, view.y / -view.z);
+	}
 
-				int curIndex;
+	if (behind == 8)
+		return glm::vec4{ 0.0f };
 
-				ovr_GetTextureSwapChainCurrentIndex(session, framebuffer.textureSwapchain, &curIndex);
-				ovr_GetTextureSwapChainBufferGL(session, framebuffer.textureSwapchain, curIndex, &curColorTexId);
+	if (behind)
+		return window;
 
-				ovr_GetTextureSwapChainCurrentIndex(session, framebuffer.depthStencilSwapchain, &curIndex);
-				ovr_GetTextureSwapChainBufferGL(session, framebuffer.depthStencilSwapchain, curIndex, &curDepthTexId);
+	return glm::vec4{ std::max(window.x, narrowed.x), std::min(window.y, narrowed.y), std::max(window.z, narrowed.z), std::min(window.w, narrowed.w) };
+}
 
-				glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.framebuffer);
-				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, curColorTexId, 0);
-				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, curDepthTexId, 0);
+bool emptyWindow(const glm::vec4& window) {
+	return window.x >= window.y || window.z >= window.w;
+}
 
-				glViewport(0, 0, framebuffer.width, framebuffer.height);
-				glScissor(0, 0, framebuffer.width, framebuffer.height);
+bool outside(const glm::vec4& plane, const glm::vec3& min, const glm::vec3& max) {
+	glm::vec3 corner{ plane.x >= 0.0f ? max.x : min.x, plane.y >= 0.0f ? max.y : min.y, plane.z >= 0.0f ? max.z : min.z };
+	return glm::dot(glm::vec3{ plane }, corner) + plane.w < 0.0f;
+}
 
-				glStencilMask(0xFF);
-				glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+bool inside(const glm::vec4& plane, const glm::vec3& min, const glm::vec3& max) {
+	glm::vec3 corner{ plane.x >= 0.0f ? min.x : max.x, plane.y >= 0.0f ? min.y : max.y, plane.z >= 0.0f ? min.z : max.z };
+	return glm::dot(glm::vec3{ plane }, corner) + plane.w >= 0.0f;
+}
 
-				OVR::Matrix4f rollPitchYaw = OVR::Matrix4f::RotationY(Yaw);
-				OVR::Matrix4f finalRollPitchYaw = rollPitchYaw * OVR::Matrix4f(EyeRenderPose[eye].Orientation);
-				OVR::Vector3f finalUp = finalRollPitchYaw.Transform(OVR::Vector3f(0, 1, 0));
-				OVR::Vector3f finalForward = finalRollPitchYaw.Transform(OVR::Vector3f(0, 0, -1));
-				OVR::Vector3f shiftedEyePos = rollPitchYaw.Transform(EyeRenderPose[eye].Position);
+bool portalPlane(const Node& node, glm::vec4& plane) {
+	if (node.portalIndex < 0)
+		return false;
 
-				previousPosition = currentPosition;
-				currentPosition = currentTranslation * glm::vec4{ shiftedEyePos.x, shiftedEyePos.y, shiftedEyePos.z, 1.0f };
+	auto& portal = portals.at(node.portalIndex);
+	auto center = 0.5f * (portal.mesh.minBorders + portal.mesh.maxBorders) + portalStreams.translations[node.portalIndex];
+	auto normal = glm::dot(portal.direction, center - node.translation) < 0.0f ? -portal.direction : portal.direction;
 
-				auto replacement = currentPosition - previousPosition;
-				auto direction = glm::normalize(replacement);
-				auto coefficient = 0.0f, distance = glm::length(replacement);
-				auto teleported = frameCount == 0 ? true : false;
+	plane = glm::vec4{ normal, epsilon - glm::dot(normal, center) };
+	return true;
+}
 
-				for (auto& portal : portals) {
-					if (epsilon < distance && glm::intersectRayPlane(previousPosition, direction, portal.mesh.origin, portal.direction, coefficient)) {
-						auto point = previousPosition + coefficient * direction;
+uint32_t nodePlanes(const Node& node, const glm::mat3& basis, glm::vec4 planes[5]) {
+	auto planeCount = 0u;
 
-						if (point.x >= portal.mesh.minBorders.x && point.y >= portal.mesh.minBorders.y && point.z >= portal.mesh.minBorders.z &&
-							point.x <= portal.mesh.maxBorders.x && point.y <= portal.mesh.maxBorders.y && point.z <= portal.mesh.maxBorders.z &&
-							0 <= coefficient && distance >= coefficient) {
+	glm::vec3 normals[4] = { { 1.0f, 0.0f, node.window.x }, { -1.0f, 0.0f, -node.window.y }, { 0.0f, 1.0f, node.window.z }, { 0.0f, -1.0f, -node.window.w } };
 
-							currentRoom = portal.targetRoom;
+	for (auto& normal : normals) {
+		auto worldNormal = basis * normal;
+		planes[planeCount++] = glm::vec4{ worldNormal, -glm::dot(worldNormal, node.translation) };
+	}
 
-							currentTranslation[3][0] += portal.translation[0];
-							currentTranslation[3][1] += portal.translation[1];
-							currentTranslation[3][2] += portal.translation[2];
+	if (portalPlane(node, planes[planeCount]))
+		planeCount++;
 
-							currentPosition = currentPosition + portal.translation;
-							previousPosition = currentPosition;
+	return planeCount;
+}
 
-							std::cout << "Teleported eye " << eye << " from room " << (int)currentRoom << " to room " << (int)portal.targetRoom << std::endl;
+void cullMeshes(PacketList<uint32_t>& drawList, Node& node, const glm::mat3& basis) {
+	node.drawOffset = static_cast<uint32_t>(drawList.size());
+	node.drawCount = 0;
 
-							teleported = true;
-							break;
-						}
-					}
-				}
+	auto root = meshStreams.roomBvh[node.room];
+
+	if (root == UINT32_MAX || emptyWindow(node.window))
+		return;
+
+	glm::vec4 planes[5];
+	auto planeCount = nodePlanes(node, basis, planes);
+
+	uint32_t stack[bvhDepth];
+	auto depth = 0u;
+
+	stack[depth++] = root;
+
+	while (depth) {
+		auto& bvhNode = meshBvh[stack[--depth]];
+		auto culled = false;
+
+		for (auto plane = 0u; plane < planeCount && !culled; plane++)
+			culled = outside(planes[plane], bvhNode.minBorders, bvhNode.maxBorders);
+
+		if (culled)
+			continue;
+
+		if (!bvhNode.count) {
+			stack[depth++] = bvhNode.left;
+			stack[depth++] = bvhNode.left + 1;
+			continue;
+		}
+
+		for (auto mesh = bvhNode.first; mesh < bvhNode.first + bvhNode.count; mesh++) {
+			auto& borders = meshes[mesh];
+			auto meshCulled = false;
+
+			for (auto plane = 0u; plane < planeCount && !meshCulled; plane++)
+				meshCulled = outside(planes[plane], borders.minBorders, borders.maxBorders);
+
+			if (!meshCulled)
+				drawList.push_back(mesh);
+		}
+	}
+
+	node.drawCount = static_cast<uint32_t>(drawList.size()) - node.drawOffset;
+}
+
+bool projectPoint(const OcclusionBuffer& buffer, const glm::mat3& basis, const glm::vec3& eyePosition, const glm::vec3& point, glm::vec3& projected) {
+	auto view = glm::transpose(basis) * (point - eyePosition);
+	auto depth = -view.z;
+
+	if (depth < occlusionNear)
+		return false;
+
+	projected.x = (view.x / depth - buffer.window.x) / (buffer.window.y - buffer.window.x) * occlusionWidth;
+	projected.y = (view.y / depth - buffer.window.z) / (buffer.window.w - buffer.window.z) * occlusionHeight;
+	projected.z = depth;
+
+	return true;
+}
+
+void rasterizeTriangle(OcclusionBuffer& buffer, glm::vec3 a, glm::vec3 b, glm::vec3 c) {
+	auto area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+
+	if (std::abs(area) < epsilon)
+		return;
+
+	if (area < 0.0f)
+		std::swap(b, c);
+
+	auto minX = std::max(0, static_cast<int32_t>(std::floor(std::min({ a.x, b.x, c.x }))));
+	auto minY = std::max(0, static_cast<int32_t>(std::floor(std::min({ a.y, b.y, c.y }))));
+	auto maxX = std::min(static_cast<int32_t>(occlusionWidth) - 1, static_cast<int32_t>(std::ceil(std::max({ a.x, b.x, c.x }))));
+	auto maxY = std::min(static_cast<int32_t>(occlusionHeight) - 1, static_cast<int32_t>(std::ceil(std::max({ a.y, b.y, c.y }))));
+
+	// Each triangle writes its farthest depth, which keeps the buffer conservative without interpolation
+	auto depth = std::max({ a.z, b.z, c.z });
+
+	for (auto y = minY; y <= maxY; y++) {
+		auto centerY = y + 0.5f;
+		auto row = buffer.depths.data() + y * occlusionWidth;
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		auto zero = _mm_setzero_ps(), triangleDepth = _mm_set1_ps(depth);
+
+		for (auto x = minX & ~3; x <= maxX; x += 4) {
+			auto centerX = _mm_add_ps(_mm_set1_ps(x + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
 
-				nodes.clear();
+			auto first = _mm_sub_ps(_mm_set1_ps((b.x - a.x) * (centerY - a.y)), _mm_mul_ps(_mm_set1_ps(b.y - a.y), _mm_sub_ps(centerX, _mm_set1_ps(a.x))));
+			auto second = _mm_sub_ps(_mm_set1_ps((c.x - b.x) * (centerY - b.y)), _mm_mul_ps(_mm_set1_ps(c.y - b.y), _mm_sub_ps(centerX, _mm_set1_ps(b.x))));
+			auto third = _mm_sub_ps(_mm_set1_ps((a.x - c.x) * (centerY - c.y)), _mm_mul_ps(_mm_set1_ps(a.y - c.y), _mm_sub_ps(centerX, _mm_set1_ps(c.x))));
 
-				std::queue<Node> queue;
+			auto mask = _mm_and_ps(_mm_cmpge_ps(first, zero), _mm_and_ps(_mm_cmpge_ps(second, zero), _mm_cmpge_ps(third, zero)));
+			auto current = _mm_loadu_ps(row + x);
 
-				Node mainNode{ 0, -1, -1, currentRoom, currentPosition };
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(mask, _mm_min_ps(current, triangleDepth)), _mm_andnot_ps(mask, current)));
+		}
+#else
+		for (auto x = minX; x <= maxX; x++) {
+			auto centerX = x + 0.5f;
+
+			if ((b.x - a.x) * (centerY - a.y) - (b.y - a.y) * (centerX - a.x) >= 0.0f &&
+				(c.x - b.x) * (centerY - b.y) - (c.y - b.y) * (centerX - b.x) >= 0.0f &&
+				(a.x - c.x) * (centerY - c.y) - (a.y - c.y) * (centerX - c.x) >= 0.0f)
+				row[x] = std::min(row[x], depth);
+		}
+#endif
+	}
+}
+
+bool occluded(const OcclusionBuffer& buffer, const glm::mat3& basis, const glm::vec3& eyePosition, const glm::vec3& min, const glm::vec3& max) {
+	auto rectangle = glm::vec4{ std::numeric_limits<float_t>::max(), -std::numeric_limits<float_t>::max(),
+		std::numeric_limits<float_t>::max(), -std::numeric_limits<float_t>::max() };
+	auto nearest = std::numeric_limits<float_t>::max();
+
+	for (auto corner = 0u; corner < 8; corner++) {
+		glm::vec3 point{ corner & 1 ? max.x : min.x, corner & 2 ? max.y : min.y, corner & 4 ? max.z : min.z }, projected;
+
+		// Bounds reaching the near plane are never reported as hidden
+		if (!projectPoint(buffer, basis, eyePosition, point, projected))
+			return false;
+
+		rectangle = glm::vec4{ std::min(rectangle.x, projected.x), std::max(rectangle.y, projected.x), std::min(rectangle.z, projected.y), std::max(rectangle.w, projected.y) };
+		nearest = std::min(nearest, projected.z);
+	}
+
+	auto minX = std::max(0, static_cast<int32_t>(std::floor(rectangle.x)));
+	auto minY = std::max(0, static_cast<int32_t>(std::floor(rectangle.z)));
+	auto maxX = std::min(static_cast<int32_t>(occlusionWidth) - 1, static_cast<int32_t>(std::floor(rectangle.y)));
+	auto maxY = std::min(static_cast<int32_t>(occlusionHeight) - 1, static_cast<int32_t>(std::floor(rectangle.w)));
+
+	if (minX > maxX || minY > maxY)
+		return false;
+
+	for (auto y = minY; y <= maxY; y++)
+		for (auto x = minX; x <= maxX; x++)
+			if (buffer.depths[y * occlusionWidth + x] >= nearest)
+				return false;
+
+	return true;
+}
+
+void rasterizeOccluders(const PacketList<uint32_t>& drawList, const Node& node, const glm::mat3& basis, OcclusionBuffer& buffer) {
+	buffer.window = node.window;
+	buffer.depths.fill(std::numeric_limits<float_t>::max());
+
+	if (emptyWindow(node.window))
+		return;
+
+	// Occluders straddling the portal plane of a child node would also cover what lies behind the portal, so only those fully past it draw
+	glm::vec4 plane;
+	auto clipped = portalPlane(node, plane);
+
+	for (auto index = node.drawOffset; index < node.drawOffset + node.drawCount; index++) {
+		auto mesh = drawList[index];
+		auto triangleCount = occluderStreams.triangleCounts[mesh];
+
+		if (!triangleCount || (clipped && !inside(plane, meshes[mesh].minBorders, meshes[mesh].maxBorders)))
+			continue;
+
+		auto corners = occluderStreams.corners.data() + 3 * occluderStreams.triangleOffsets[mesh];
+
+		for (auto triangle = 0u; triangle < triangleCount; triangle++) {
+			glm::vec3 projected[3];
+
+			if (projectPoint(buffer, basis, node.translation, corners[3 * triangle], projected[0]) &&
+				projectPoint(buffer, basis, node.translation, corners[3 * triangle + 1], projected[1]) &&
+				projectPoint(buffer, basis, node.translation, corners[3 * triangle + 2], projected[2]))
+				rasterizeTriangle(buffer, projected[0], projected[1], projected[2]);
+		}
+	}
+}
+
+void occludeMeshes(PacketList<uint32_t>& drawList, Node& node, const glm::mat3& basis, const OcclusionBuffer& buffer) {
+	auto last = node.drawOffset;
+
+	for (auto index = node.drawOffset; index < node.drawOffset + node.drawCount; index++) {
+		auto mesh = drawList[index];
+
+		if (!occluded(buffer, basis, node.translation, meshes[mesh].minBorders, meshes[mesh].maxBorders))
+			drawList[last++] = mesh;
+	}
 
-				queue.push(mainNode);
-				nodes.push_back(mainNode);
+	drawList.resize(last);
+	node.drawCount = last - node.drawOffset;
+}
+
+glm::mat3 viewBasis(const RenderPacket& packet, int eye) {
+	auto forward = glm::vec3{ packet.forwardVectors[eye].x, packet.forwardVectors[eye].y, packet.forwardVectors[eye].z };
+	auto right = glm::normalize(glm::cross(forward, glm::vec3{ packet.upVectors[eye].x, packet.upVectors[eye].y, packet.upVectors[eye].z }));
+
+	return glm::mat3{ right, glm::cross(right, forward), -forward };
+}
+
+void updateEye(RenderPacket& packet, int eye, const ovrPosef& eyePose) {
+	auto& eyeNodes = packet.nodes[eye];
+	auto& log = traversalLogs[eye];
+	auto& currentRoom = currentRooms[eye];
+	auto& previousPosition = previousPositions[eye];
+	auto& currentPosition = currentPositions[eye];
+	auto& currentTranslation = currentTranslations[eye];
+
+	OVR::Matrix4f rollPitchYaw = OVR::Matrix4f::RotationY(yaw);
+	OVR::Matrix4f finalRollPitchYaw = rollPitchYaw * OVR::Matrix4f(eyePose.Orientation);
+	OVR::Vector3f shiftedEyePos = rollPitchYaw.Transform(eyePose.Position);
+
+	packet.upVectors[eye] = finalRollPitchYaw.Transform(OVR::Vector3f(0, 1, 0));
+	packet.forwardVectors[eye] = finalRollPitchYaw.Transform(OVR::Vector3f(0, 0, -1));
+
+	auto basis = viewBasis(packet, eye);
 
-				if(teleported)
-					std::cout << "Node list for eye " << eye << ": " << mainNode.layer << ":" << (int)mainNode.room << " ";
+	previousPosition = currentPosition;
+	currentPosition = currentTranslation * glm::vec4{ shiftedEyePos.x, shiftedEyePos.y, shiftedEyePos.z, 1.0f };
 
-				while (nodes.size() != nodeLimit && !queue.empty()) {
-					int32_t parentIndex = nodes.size() - queue.size();
+	auto replacement = currentPosition - previousPosition;
+	auto direction = glm::normalize(replacement);
+	auto distance = glm::length(replacement);
+	auto teleported = packet.frameIndex == 0 ? true : false;
+	auto teleportProfile = beginProfile("teleport", eye, -1);
+	auto crossing = -1;
 
-					auto parentNode = queue.front();
-					queue.pop();
+	auto roomFirst = portalStreams.roomOffsets[currentRoom];
+	auto roomCount = portalStreams.roomOffsets[currentRoom + 1] - roomFirst;
 
-					for (int32_t i = 0; i < portalCount; i++) {
-						auto& portal = portals.at(i);
+	if (epsilon < distance) {
+		auto coefficient = 0.0f;
 
-						if (visible(portal, parentNode)) {
-							auto translation = parentNode.translation + portal.translation;
-							Node portalNode{ parentNode.layer + 1, parentIndex, i, portal.targetRoom, translation };
+		if (roomCount < 2 * jobGrain)
+			crossing = findCrossing(previousPosition, direction, distance, roomFirst, roomFirst + roomCount, coefficient);
 
-							queue.push(portalNode);
-							nodes.push_back(portalNode);
+		else {
+			// Each chunk reports its earliest crossing, the earliest overall wins and ties go to the lower chunk
+			std::array<int32_t, crossingChunkCapacity> crossings;
+			std::array<float_t, crossingChunkCapacity> coefficients;
+			auto grain = std::max(jobGrain, (roomCount + crossingChunkCapacity - 1) / crossingChunkCapacity);
+			auto chunkCount = (roomCount + grain - 1) / grain;
 
-							if (teleported)
-								std::cout << portalNode.layer << ":" << (int)portalNode.room << " ";
+			parallelFor(roomCount, grain, [&](uint32_t first, uint32_t last) {
+				crossings[first / grain] = findCrossing(previousPosition, direction, distance, roomFirst + first, roomFirst + last, coefficients[first / grain]);
+			});
 
-							if (nodes.size() == nodeLimit)
-								break;
-						}
-					}
+			coefficient = std::numeric_limits<float_t>::infinity();
+
+			for (auto chunk = 0u; chunk < chunkCount; chunk++)
+				if (crossings[chunk] >= 0 && coefficients[chunk] < coefficient) {
+					crossing = crossings[chunk];
+					coefficient = coefficients[chunk];
 				}
+		}
 
-				if (teleported)
-					std::cout << std::endl;
+		if (crossing >= 0)
+			crossing = portalStreams.roomPortals[crossing];
+	}
+
+	if (crossing >= 0) {
+		auto targetRoom = portalStreams.targetRooms[crossing];
+		auto& translation = portalStreams.translations[crossing];
+
+		log.append("Teleported eye ").append(std::to_string(eye)).append(" from room ").append(std::to_string(currentRoom)).append(" to room ").append(std::to_string(targetRoom)).append("\n");
+
+		currentRoom = targetRoom;
+
+		currentTranslation[3][0] += translation[0];
+		currentTranslation[3][1] += translation[1];
+		currentTranslation[3][2] += translation[2];
+
+		currentPosition = currentPosition + translation;
+		previousPosition = currentPosition;
+
+		teleported = true;
+	}
+
+	endProfile(teleportProfile);
+	auto traversalProfile = beginProfile("traversal", eye, -1);
+
+	eyeNodes.clear();
+
+	auto& fov = hmdDesc.DefaultEyeFov[eye];
+	Node mainNode{ 0, -1, -1, currentRoom, currentPosition, glm::vec4{ -fov.LeftTan, fov.RightTan, -fov.DownTan, fov.UpTan }, 0, 0, currentRoom, 0, 0 };
+
+	eyeNodes.push_back(mainNode);
+
+	if(teleported)
+		log.append("Node list for eye ").append(std::to_string(eye)).append(": ").append(std::to_string(mainNode.layer)).append(":").append(std::to_string(mainNode.room)).append(" ");
+
+	auto& drawList = packet.drawLists[eye];
+	auto& occlusion = occlusionBuffers[eye];
+
+	drawList.clear();
+
+	// The node list doubles as the breadth-first queue, nodes past parentIndex are still waiting for expansion.
+	for (int32_t parentIndex = 0; parentIndex < static_cast<int32_t>(eyeNodes.size()); parentIndex++) {
+		auto& parentNode = eyeNodes.at(parentIndex);
+
+		cullMeshes(drawList, parentNode, basis);
+		rasterizeOccluders(drawList, parentNode, basis, occlusion);
+
+		// With GPU culling the compute pass picks the meshes, the frustum-culled list only supplied the occluders
+		if (gpuCulling) {
+			drawList.resize(parentNode.drawOffset);
+			parentNode.drawCount = 0;
+		}
+
+		else
+			occludeMeshes(drawList, parentNode, basis, occlusion);
+
+		if (eyeNodes.size() == nodeLimit)
+			continue;
 
-				for (uint8_t index = 0; index < nodes.size(); index++) {
-					auto& node = nodes.at(index);
+		auto& visibility = portalVisibility;
 
-					OVR::Vector3f nodeEyePos(node.translation.x, node.translation.y, node.translation.z);
+		for (auto cursor = visibility.setOffsets[parentNode.visibleSet]; cursor < visibility.setOffsets[parentNode.visibleSet + 1]; cursor++) {
+			auto position = visibility.setPositions[cursor];
+			int32_t i = portalStreams.roomPortals[position];
 
-					OVR::Matrix4f view = OVR::Matrix4f::LookAtRH(nodeEyePos, nodeEyePos + finalForward, finalUp);
-					OVR::Matrix4f proj = ovrMatrix4f_Projection(hmdDesc.DefaultEyeFov[eye], 0.01f, 1000.0f, ovrProjection_None);
-					posTimewarpProjectionDesc = ovrTimewarpProjectionDesc_FromProjection(proj, ovrProjection_None);
+			if (!visible(i, parentNode))
+				continue;
 
-					auto transform = proj * view;
-					transform.Transpose();
+			auto& portal = portals.at(i);
+			auto window = narrowWindow(parentNode.window, basis, parentNode.translation, portal.mesh.minBorders, portal.mesh.maxBorders);
 
-					glBufferData(GL_UNIFORM_BUFFER, sizeof(transform), (GLfloat*)&transform, GL_DYNAMIC_DRAW);
+			if (!emptyWindow(window) && !occluded(occlusion, basis, parentNode.translation, portal.mesh.minBorders, portal.mesh.maxBorders)) {
+				auto translation = parentNode.translation + portalStreams.translations[i];
+				Node portalNode{ parentNode.layer + 1, parentIndex, i, portalStreams.targetRooms[i], translation, window, 0, 0, 0, 0, 0 };
 
-					drawNodeView(index);
+				// Behind the first portal the viewer's side picks the set, further down the pair of portals already fixes it
+				if (parentNode.portalIndex < 0) {
+					auto center = 0.5f * (portal.mesh.minBorders + portal.mesh.maxBorders) + portalStreams.translations[i];
+					auto side = glm::dot(portal.direction, translation - center) >= 0.0f ? 0u : 1u;
+
+					portalNode.visibleSet = roomCapacity + 2 * i + side;
+				}
+
+				else {
+					auto entryRoom = portalStreams.targetRooms[parentNode.portalIndex];
+					portalNode.visibleSet = roomCapacity + 2 * static_cast<uint32_t>(portals.size()) + visibility.sequenceBases[parentNode.portalIndex] +
+						position - portalStreams.roomOffsets[entryRoom];
 				}
 
-				glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.framebuffer);
-				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
-				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+				eyeNodes.push_back(portalNode);
 
-				ovr_CommitTextureSwapChain(session, framebuffer.textureSwapchain);
-				ovr_CommitTextureSwapChain(session, framebuffer.depthStencilSwapchain);
-			}
+				if (teleported)
+					log.append(std::to_string(portalNode.layer)).append(":").append(std::to_string(portalNode.room)).append(" ");
 
-			ovrLayerEyeFovDepth ld{};
-			ld.Header.Type = ovrLayerType_EyeFovDepth;
-			ld.Header.Flags = ovrLayerFlag_TextureOriginAtBottomLeft;
-			ld.ProjectionDesc = posTimewarpProjectionDesc;
-			ld.SensorSampleTime = sensorSampleTime;
-
-			for (int eye = 0; eye < 2; eye++)
-			{
-				auto& framebuffer = framebuffers[eye];
-
-				ld.ColorTexture[eye] = framebuffer.textureSwapchain;
-				ld.DepthTexture[eye] = framebuffer.depthStencilSwapchain;
-				ld.Viewport[eye] = OVR::Recti(OVR::Sizei(framebuffer.width, framebuffer.height));
-				ld.Fov[eye] = hmdDesc.DefaultEyeFov[eye];
-				ld.RenderPose[eye] = EyeRenderPose[eye];
+				if (eyeNodes.size() == nodeLimit)
+					break;
 			}
+		}
+	}
+
+	endProfile(traversalProfile);
+
+	if (teleported)
+		log.append("\n");
+
+	auto recordProfile = beginProfile("record", eye, -1);
+	recordEye(packet, eye);
+	endProfile(recordProfile);
+}
+
+void updateEyes(RenderPacket& packet) {
+	std::atomic<uint32_t> counter = 0;
+
+	submitJob(counter, [&packet] {
+		profiledFrame = packet.frameIndex;
+		updateEye(packet, 1, packet.record.eyePoses[1]);
+	});
+
+	updateEye(packet, 0, packet.record.eyePoses[0]);
+	waitJobs(counter);
+
+	for (auto& log : traversalLogs)
+		if (!log.empty()) {
+			std::cout << log << std::flush;
+			log.clear();
+		}
+}
+
+void submitMultiresFrame(const PoseRecord& record) {
+	ovrLayerEyeFovMultires lm{};
+	lm.Header.Type = ovrLayerType_EyeFovMultires;
+	lm.Header.Flags = ovrLayerFlag_TextureOriginAtBottomLeft;
+	lm.SensorSampleTime = record.sensorSampleTime;
+	lm.TextureLayout = ovrTextureLayout_Octilinear;
+
+	for (int eye = 0; eye < 2; eye++)
+	{
+		auto& framebuffer = framebuffers[eye];
+		auto& octilinear = lm.TextureLayoutDesc.Octilinear[eye];
+		auto renderWidth = lensViewportWidth(framebuffer), renderHeight = lensViewportHeight(framebuffer);
+
+		lm.ColorTexture[eye] = framebuffer.textureSwapchain;
+		lm.Viewport[eye] = OVR::Recti(OVR::Sizei(renderWidth, renderHeight));
+		lm.Fov[eye] = hmdDesc.DefaultEyeFov[eye];
+		lm.RenderPose[eye] = record.eyePoses[eye];
+
+		octilinear.WarpLeft = octilinear.WarpRight = octilinear.WarpUp = octilinear.WarpDown = multiresWarp;
+		octilinear.SizeLeft = float_t(renderWidth / 2);
+		octilinear.SizeRight = float_t(renderWidth - renderWidth / 2);
+		octilinear.SizeUp = float_t(renderHeight - renderHeight / 2);
+		octilinear.SizeDown = float_t(renderHeight / 2);
+	}
+
+	auto submitProfile = beginProfile("submit", -1, -1);
+
+	ovrLayerHeader* layers = &lm.Header;
+	ovr_EndFrame(session, renderFrameIndex, nullptr, &layers, 1);
+
+	endProfile(submitProfile);
+}
+
+void submitFrame(const PoseRecord& record) {
+	if (multires && multiresLayer) {
+		submitMultiresFrame(record);
+		return;
+	}
+
+	// Vulkan eyes are rendered through a flipped viewport, so their rows already start at the top
+	ovrLayerEyeFovDepth ld{};
+	ld.Header.Type = ovrLayerType_EyeFovDepth;
+	ld.Header.Flags = vulkan ? 0 : ovrLayerFlag_TextureOriginAtBottomLeft;
+	ld.ProjectionDesc = timewarpProjectionDesc;
+	ld.SensorSampleTime = record.sensorSampleTime;
+
+	for (int eye = 0; eye < 2; eye++)
+	{
+		auto& framebuffer = framebuffers[eye];
+
+		ld.ColorTexture[eye] = framebuffer.textureSwapchain;
+		ld.DepthTexture[eye] = framebuffer.depthStencilSwapchain;
+		ld.Viewport[eye] = OVR::Recti(OVR::Sizei(framebuffer.viewportWidth, framebuffer.viewportHeight));
+		ld.Fov[eye] = hmdDesc.DefaultEyeFov[eye];
+		ld.RenderPose[eye] = record.eyePoses[eye];
+	}
+
+	auto submitProfile = beginProfile("submit", -1, -1);
+
+	ovrLayerHeader* layers = &ld.Header;
+	ovr_EndFrame(session, renderFrameIndex, nullptr, &layers, 1);
+
+	endProfile(submitProfile);
+}
+
+template <typename Type, uint32_t Capacity>
+Type& acquireSlot(SpscQueue<Type, Capacity>& queue) {
+	auto tail = queue.tail.load(std::memory_order_relaxed);
+
+	// The ring is full while the consumer is a whole capacity behind
+	for (auto head = queue.head.load(std::memory_order_acquire); tail - head == Capacity; head = queue.head.load(std::memory_order_acquire))
+		queue.head.wait(head, std::memory_order_acquire);
+
+	return queue.slots.at(tail % Capacity);
+}
+
+template <typename Type, uint32_t Capacity>
+void publishSlot(SpscQueue<Type, Capacity>& queue) {
+	queue.tail.fetch_add(1, std::memory_order_release);
+	queue.tail.notify_one();
+}
+
+template <typename Type, uint32_t Capacity>
+Type& frontSlot(SpscQueue<Type, Capacity>& queue) {
+	auto head = queue.head.load(std::memory_order_relaxed);
+
+	for (auto tail = queue.tail.load(std::memory_order_acquire); tail == head; tail = queue.tail.load(std::memory_order_acquire))
+		queue.tail.wait(tail, std::memory_order_acquire);
+
+	return queue.slots.at(head % Capacity);
+}
+
+template <typename Type, uint32_t Capacity>
+void releaseSlot(SpscQueue<Type, Capacity>& queue) {
+	queue.head.fetch_add(1, std::memory_order_release);
+	queue.head.notify_one();
+}
+
+void checkAllocations(uint64_t allocations) {
+#ifndef NDEBUG
+	auto frameAllocations = allocationCount.load(std::memory_order_relaxed) - allocations;
+
+	if (frameIndex < allocationWarmup || frameAllocations == 0)
+		return;
+
+	if (steadyAllocations == 0)
+		std::cout << "Frame " << frameIndex << " performed " << frameAllocations << " heap allocations" << std::endl;
+
+	steadyAllocations += frameAllocations;
+#else
+	static_cast<void>(allocations);
+#endif
+}
+
+void markFrameBegun(int64_t index) {
+	begunFrames.store(index + 1, std::memory_order_release);
+	begunFrames.notify_one();
+}
+
+void waitFrameBegun(int64_t index) {
+	// LibOVR expects the previous frame to have begun before the next wait
+	for (auto begun = begunFrames.load(std::memory_order_acquire); begun < index; begun = begunFrames.load(std::memory_order_acquire))
+		begunFrames.wait(begun, std::memory_order_acquire);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void renderLoop() {
+	profileThread = ProfileThread::Render;
+
+	jobQueueIndex = static_cast<uint32_t>(jobQueues.size() - 1);
+	renderer->attachThread();
+
+	while (true) {
+		auto& packet = frontSlot(renderQueue);
+
+		if (packet.quit) {
+			releaseSlot(renderQueue);
+			break;
+		}
+
+		renderer->renderFrame(packet);
+		releaseSlot(renderQueue);
+	}
+
+	renderer->detachThread();
+}
+
+void draw() {
+	previousTime = std::chrono::high_resolution_clock::now();
+	begunFrames = frameIndex;
+
+	renderer->detachThread();
+	std::thread renderThread(renderLoop);
+
+	// Frame N+1 is traversed here while the render thread submits frame N
+	while (true) {
+		profiledFrame = frameIndex;
+		auto frameProfile = beginProfile("frame", -1, -1);
+		auto allocations = allocationCount.load(std::memory_order_relaxed);
+
+		if (frameLimit && frameIndex == frameLimit)
+			break;
+
+		if (window) {
+			glfwPollEvents();
+
+			if (glfwWindowShouldClose(window))
+				break;
+		}
+
+		PoseRecord record{};
+		auto& sessionStatus = record.sessionStatus;
+
+		if (replaying) {
+			if (!readPoseRecord(record))
+				break;
+		}
+
+		else if (session)
+			ovr_GetSessionStatus(session, &sessionStatus);
+
+		else
+			sessionStatus.IsVisible = ovrTrue;
+
+		if (sessionStatus.ShouldQuit)
+			break;
+
+		if (sessionStatus.ShouldRecenter && !replaying && session)
+			ovr_RecenterTrackingOrigin(session);
 
-			ovrLayerHeader* layers = &ld.Header;
-			ovr_SubmitFrame(session, frameCount, nullptr, &layers, 1);
+		auto& packet = acquireSlot(renderQueue);
+
+		packet.quit = false;
+		packet.visible = sessionStatus.IsVisible;
+		packet.frameIndex = frameIndex;
+
+		if (sessionStatus.IsVisible)
+		{
+			waitFrameBegun(frameIndex);
+
+			auto waitProfile = beginProfile("wait", -1, -1);
+
+			if (session)
+				ovr_WaitToBeginFrame(session, frameIndex);
+
+			endProfile(waitProfile);
+
+			if (!replaying)
+				samplePoses(record);
 		}
 
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, mirrorFramebuffer);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		packet.record = record;
 
-		glBlitFramebuffer(0, height, width, 0, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (sessionStatus.IsVisible)
+			updateEyes(packet);
+
+		publishSlot(renderQueue);
+
+		writePoseRecord(record);
+		endProfile(frameProfile);
+
+		currentTime = std::chrono::high_resolution_clock::now();
+		timeDelta = std::chrono::duration<double_t>(currentTime - previousTime).count();
+		previousTime = currentTime;
+
+		checkPoint += timeDelta;
+		totalTime += timeDelta;
 
-		glfwSwapBuffers(window);
 		updateFeedbacks();
+		checkAllocations(allocations);
 
 		frameCount++;
+		frameIndex++;
 	}
+
+	acquireSlot(renderQueue).quit = true;
+	publishSlot(renderQueue);
+
+	renderThread.join();
+	renderer->attachThread();
 }
 
 void clean() {
-	glfwTerminate();
+	totalFrameCount += frameCount;
+
+	if (totalFrameCount)
+		std::cout << "Rendered " << totalFrameCount << " frames in " << totalTime << " s, "
+			<< 1000.0 * totalTime / totalFrameCount << " ms per frame" << std::endl;
 
-	ovr_Destroy(session);
-	ovr_Shutdown();
+#ifndef NDEBUG
+	std::cout << "Steady-state heap allocations: " << steadyAllocations << std::endl;
+#endif
+
+	exportProfile();
+	writeCaptures();
+	renderer->clean();
+	cleanJobs();
+
+	if (window)
+		glfwTerminate();
+
+	if (session) {
+		ovr_Destroy(session);
+		ovr_Shutdown();
+	}
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+	if (argc > 3 && !std::string{ argv[1] }.compare("compare"))
+		return compareImages(argv[2], argv[3], argc > 4 ? std::stod(argv[4]) : 0.0);
+
+	if (argc > 1 && !std::string{ argv[1] }.compare("benchmark"))
+		return benchmarkCrossing(argc > 2 ? uint32_t(std::stoul(argv[2])) : 4096);
+
+	if (argc > 1 && !std::string{ argv[1] }.compare("jobs"))
+		return testJobs(argc > 2 ? uint32_t(std::stoul(argv[2])) : 1024);
+
+	if (argc > 1 && !std::string{ argv[1] }.compare("generate")) {
+		auto argument = [&](int index, uint32_t fallback) { return argc > index ? uint32_t(std::stoul(argv[index])) : fallback; };
+		generateScene(argc > 2 ? std::string{ argv[2] } + "/" : "Assets/synthetic/", argument(3, 16), argument(4, 2), argument(5, 256), argument(6, 8));
+		return 0;
+	}
+
+	for (auto index = 1; index < argc; index++) {
+		std::string argument{ argv[index] };
+
+		if (!argument.compare("--profile") && index + 1 < argc)
+			profilePath = argv[++index];
+		else if (!argument.compare("--record") && index + 1 < argc)
+			recordPath = argv[++index];
+		else if (!argument.compare("--replay") && index + 1 < argc)
+			replayPath = argv[++index];
+		else if (!argument.compare("--lens-matched"))
+			lensMatched = true;
+		else if (!argument.compare("--multires"))
+			multires = true;
+		else if (!argument.compare("--gpu-culling"))
+			gpuCulling = true;
+		else if (!argument.compare("--lighting"))
+			lighting = true;
+		else if (!argument.compare("--quantized"))
+			quantized = true;
+		else if (!argument.compare("--no-shader-cache"))
+			shaderCacheDisabled = true;
+		else if (!argument.compare("--vulkan"))
+			vulkan = true;
+		else if (!argument.compare("--headless"))
+			headless = true;
+		else if (!argument.compare("--frames") && index + 1 < argc)
+			frameLimit = std::stoll(argv[++index]);
+		else if (!argument.compare("--capture") && index + 2 < argc) {
+			captureFrame = std::stoll(argv[++index]);
+			capturePath = argv[++index];
+		}
+		else
+			sceneFolder = argument + "/";
+	}
+
+	if (vulkan)
+		renderer = std::make_unique<VulkanRenderer>();
+	else
+		renderer = std::make_unique<GlRenderer>();
+
 	setup();
 	draw();
 	clean();
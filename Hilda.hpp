@@ -2,22 +2,26 @@
 
 #define TINYGLTF_USE_CPP14
 #define TINYGLTF_NO_EXTERNAL_IMAGE
-#define TINYGLTF_IMPLEMENTATION
 
 #define STBI_ONLY_JPEG
 #define STBI_NO_FAILURE_STRINGS
-#define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 
 #include <array>
+#include <new>
+#include <stdexcept>
+#include <atomic>
 #include <string>
 #include <limits>
 #include <optional>
 #include <vector>
+#include <algorithm>
 #include <queue>
+#include <functional>
+#include <random>
 #include <chrono>
 #include <memory>
 #include <fstream>
+#include <sstream>
 #include <iostream>
 #include <filesystem>
 #include <thread>
@@ -26,8 +30,28 @@
 #include <shared_mutex>
 #include <unordered_map>
 
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#endif
+
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtx/intersect.hpp>
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtx/transform.hpp>
@@ -35,12 +59,50 @@
 #include <tinygltf/tiny_gltf.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <vulkan/vulkan.h>
 
 #include <LibOVR/OVR_CAPI.h>
 #include <LibOVR/OVR_CAPI_GL.h>
+#include <LibOVR/OVR_CAPI_Vk.h>
 #include <LibOVR/Extras/OVR_Math.h>
 
 constexpr auto epsilon = 0.0009765625f;
+constexpr auto profileCapacity = 1u << 16;
+constexpr auto profileLatency = 4u;
+constexpr auto hiddenAreaSegments = 64u;
+constexpr auto minimumPixelDensity = 0.5f;
+constexpr auto defaultPixelDensity = 1.0f;
+constexpr auto maximumPixelDensity = 1.5f;
+constexpr auto resolutionHistory = 8u;
+constexpr auto lensMatchedWarp = 0.5f;
+constexpr auto multiresWarp = 0.35f;
+constexpr auto renderQueueCapacity = 2u;
+constexpr auto jobGrain = 64u;
+constexpr auto jobCapacity = 256u;
+constexpr auto nodeCapacity = 16u;
+constexpr auto crossingChunkCapacity = 64u;
+constexpr auto traversalLogCapacity = 4096u;
+constexpr auto allocationWarmup = 16;
+constexpr auto roomCapacity = 256u;
+constexpr auto bvhLeafSize = 4u;
+constexpr auto bvhDepth = 64u;
+constexpr auto occlusionWidth = 64u;
+constexpr auto occlusionHeight = 64u;
+constexpr auto occlusionNear = 0.05f;
+constexpr auto occluderTriangleLimit = 64u;
+constexpr auto cullGroupSize = 64u;
+constexpr auto portalPointLimit = 16u;
+constexpr auto poseRecordMagic = 0x31525048u;	// "HPR1"
+constexpr auto vulkanFrameCount = 2u;
+constexpr auto headlessTextureWidth = 1344u;
+constexpr auto headlessTextureHeight = 1600u;
+
+enum class ProfileThread : uint32_t {
+	Main,
+	Gpu,
+	Render,
+	Worker
+};
 
 enum class Type {
 	Mesh,
@@ -48,12 +110,48 @@ enum class Type {
 	Camera
 };
 
+enum class Command : uint32_t {
+	ClearDepth,
+	HiddenArea,
+	Stencil,
+	StencilReplace,
+	DrawMesh,
+	DrawCulled,
+	BeginMask,
+	DrawMask,
+	EndMask,
+	BeginConditional,
+	EndConditional
+};
+
 struct Framebuffer {
 	uint32_t width;
 	uint32_t height;
+	uint32_t viewportWidth;
+	uint32_t viewportHeight;
 	GLuint framebuffer;
 	ovrTextureSwapChain depthStencilSwapchain;
 	ovrTextureSwapChain textureSwapchain;
+	GLuint colorTexture;
+	GLuint depthStencilTexture;
+
+	uint32_t lensWidth;
+	uint32_t lensHeight;
+	GLuint lensFramebuffer;
+	GLuint lensColorTexture;
+	GLuint lensDepthStencilTexture;
+};
+
+struct ShaderVariant {
+	bool lighting;
+	bool quantized;
+	bool maskOnly;
+};
+
+struct ShaderStage {
+	std::string path;
+	GLenum type;
+	std::string header;
 };
 
 struct Vertex {
@@ -62,6 +160,66 @@ struct Vertex {
 	glm::vec2 texture;
 };
 
+struct QuantizedVertex {
+	int16_t position[4];
+	int8_t normal[4];
+	uint16_t texture[2];
+};
+
+struct MappedFile {
+	const uint8_t* data;
+	size_t size;
+
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+};
+
+struct GltfAccessor {
+	int32_t bufferView;
+	uint64_t byteOffset;
+	uint32_t componentType;
+	uint32_t componentCount;
+	bool normalized;
+	uint64_t count;
+};
+
+struct GltfView {
+	int32_t buffer;
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t byteStride;
+};
+
+struct GltfPrimitive {
+	int32_t indices;
+	int32_t material;
+	int32_t position;
+	int32_t normal;
+	int32_t texture;
+};
+
+struct GltfNode {
+	int32_t mesh;
+	glm::vec3 translation;
+	glm::quat rotation;
+	glm::vec3 scale;
+};
+
+struct GltfModel {
+	std::vector<GltfAccessor> accessors;
+	std::vector<GltfView> views;
+	std::vector<std::string> bufferUris;
+	std::vector<MappedFile> buffers;
+
+	std::vector<std::vector<GltfPrimitive>> meshes;
+	std::vector<int32_t> materialTextures;
+	std::vector<int32_t> textureSources;
+	std::vector<std::string> imageNames;
+	std::vector<GltfNode> nodes;
+};
+
 struct Image {
 	int32_t width;
 	int32_t height;
@@ -88,13 +246,145 @@ struct Mesh {
 
 struct Portal {
 	Mesh mesh;
-	uint8_t pairIndex;
+	int32_t pairIndex;
 	uint8_t targetRoom;
 
 	glm::vec3 direction;
 	glm::vec3 translation;
 };
 
+struct MeshStreams {
+	std::vector<uint32_t> indexOffsets;
+	std::vector<uint32_t> indexLengths;
+	std::vector<int32_t> vertexOffsets;
+	std::vector<uint32_t> textureIndices;
+
+	std::vector<uint32_t> roomOffsets;
+	std::vector<uint32_t> roomBvh;
+};
+
+struct OccluderStreams {
+	std::vector<uint32_t> triangleOffsets;
+	std::vector<uint32_t> triangleCounts;
+	std::vector<glm::vec3> corners;
+};
+
+struct OcclusionBuffer {
+	glm::vec4 window;
+	std::array<float_t, occlusionWidth * occlusionHeight> depths;
+};
+
+struct BvhNode {
+	glm::vec3 minBorders;
+	glm::vec3 maxBorders;
+
+	uint32_t first;
+	uint32_t count;
+	uint32_t left;
+};
+
+struct CullMesh {
+	glm::vec4 minBorders;
+	glm::vec4 maxBorders;
+
+	uint32_t indexLength;
+	uint32_t indexOffset;
+	int32_t vertexOffset;
+	uint32_t textureIndex;
+
+	uint32_t slot;
+	uint32_t padding[3];
+};
+
+struct CullNode {
+	glm::vec4 planes[5];
+
+	uint32_t first;
+	uint32_t count;
+	uint32_t planeCount;
+	uint32_t padding;
+};
+
+struct DrawCommand {
+	uint32_t count;
+	uint32_t instanceCount;
+	uint32_t firstIndex;
+	int32_t baseVertex;
+	uint32_t baseInstance;
+};
+
+struct PortalStreams {
+	std::vector<uint32_t> indexOffsets;
+	std::vector<uint32_t> indexLengths;
+	std::vector<int32_t> vertexOffsets;
+
+	std::vector<uint8_t> rooms;
+	std::vector<uint8_t> targetRooms;
+	std::vector<int32_t> pairIndices;
+	std::vector<glm::vec3> translations;
+
+	std::vector<uint32_t> roomOffsets;
+	std::vector<uint32_t> roomPortals;
+};
+
+// Candidate sets are lists of CSR positions, the first roomCapacity sets are whole rooms, then two viewer sides per portal,
+// then one set per portal pair that can follow each other
+struct PortalVisibility {
+	std::vector<uint32_t> sequenceBases;
+	std::vector<uint32_t> setOffsets;
+	std::vector<uint32_t> setPositions;
+};
+
+struct PortalBounds {
+	std::vector<float_t> originX;
+	std::vector<float_t> originY;
+	std::vector<float_t> originZ;
+	std::vector<float_t> normalX;
+	std::vector<float_t> normalY;
+	std::vector<float_t> normalZ;
+
+	std::vector<float_t> minX;
+	std::vector<float_t> minY;
+	std::vector<float_t> minZ;
+	std::vector<float_t> maxX;
+	std::vector<float_t> maxY;
+	std::vector<float_t> maxZ;
+};
+
+struct ProfileEvent {
+	const char* name;
+	uint32_t frame;
+	int32_t eye;
+	int32_t node;
+	bool gpu;
+	ProfileThread thread;
+	uint64_t begin;
+	uint64_t end;
+};
+
+struct HiddenArea {
+	GLint first;
+	GLsizei count;
+};
+
+struct PoseRecord {
+	ovrSessionStatus sessionStatus;
+	ovrPosef eyePoses[2];
+	double_t sensorSampleTime;
+};
+
+struct PoseRecordHeader {
+	uint32_t magic;
+	uint32_t recordSize;
+};
+
+struct Geometry {
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> texcoords;
+	std::vector<GLushort> indices;
+};
+
 struct Node {
 	uint32_t layer;
 	int32_t parentIndex;
@@ -102,4 +392,337 @@ struct Node {
 
 	uint8_t room;
 	glm::vec3 translation;
+
+	glm::vec4 window;
+	uint32_t drawOffset;
+	uint32_t drawCount;
+
+	uint32_t visibleSet;
+
+	uint32_t commandOffset;
+	uint32_t commandCount;
+};
+
+// Node passes are recorded as API-neutral commands, backends only replay them
+struct RenderCommand {
+	Command type;
+	uint32_t arguments[4];
+};
+
+template <typename Type, uint32_t Capacity>
+struct FixedVector {
+	std::array<Type, Capacity> items;
+	uint32_t count;
+
+	uint32_t size() const {
+		return count;
+	}
+
+	void clear() {
+		count = 0;
+	}
+
+	void push_back(const Type& item) {
+		if (count >= Capacity)
+			throw std::length_error("FixedVector capacity exceeded");
+
+		items[count++] = item;
+	}
+
+	Type& at(uint32_t index) {
+		if (index >= count)
+			throw std::out_of_range("FixedVector index out of range");
+
+		return items[index];
+	}
+
+	const Type& at(uint32_t index) const {
+		if (index >= count)
+			throw std::out_of_range("FixedVector index out of range");
+
+		return items[index];
+	}
+
+	Type* begin() {
+		return items.data();
+	}
+
+	Type* end() {
+		return items.data() + count;
+	}
+};
+
+template <typename Type>
+struct PacketList {
+	std::unique_ptr<Type[]> items;
+	uint32_t capacity;
+	uint32_t count;
+
+	void allocate(uint32_t size) {
+		items = std::make_unique<Type[]>(size);
+		capacity = size;
+		count = 0;
+	}
+
+	uint32_t size() const {
+		return count;
+	}
+
+	void clear() {
+		count = 0;
+	}
+
+	void resize(uint32_t size) {
+		if (size > capacity)
+			throw std::length_error("PacketList capacity exceeded");
+
+		count = size;
+	}
+
+	void push_back(const Type& item) {
+		if (count >= capacity)
+			throw std::length_error("PacketList capacity exceeded");
+
+		items[count++] = item;
+	}
+
+	Type& operator[](uint32_t index) {
+		return items[index];
+	}
+
+	const Type& operator[](uint32_t index) const {
+		return items[index];
+	}
+
+	Type* data() {
+		return items.get();
+	}
+
+	const Type* data() const {
+		return items.get();
+	}
+
+	Type* begin() {
+		return items.get();
+	}
+
+	Type* end() {
+		return items.get() + count;
+	}
+};
+
+struct RenderPacket {
+	bool quit;
+	bool visible;
+	int64_t frameIndex;
+	PoseRecord record;
+
+	OVR::Vector3f upVectors[2];
+	OVR::Vector3f forwardVectors[2];
+	FixedVector<Node, nodeCapacity> nodes[2];
+	PacketList<uint32_t> drawLists[2];
+	PacketList<RenderCommand> commandLists[2];
+};
+
+template <typename Type, uint32_t Capacity>
+struct SpscQueue {
+	std::array<Type, Capacity> slots;
+	std::atomic<uint32_t> head;
+	std::atomic<uint32_t> tail;
+};
+
+struct Job {
+	std::function<void()> task;
+	std::atomic<uint32_t>* counter;
+};
+
+struct JobQueue {
+	std::mutex mutex;
+	std::array<Job, jobCapacity> jobs;
+	uint32_t head;
+	uint32_t tail;
+};
+
+struct VulkanBuffer {
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+	VkDeviceSize size;
+	void* mapped;
+};
+
+struct VulkanImage {
+	VkImage image;
+	VkDeviceMemory memory;
+	VkImageView view;
+};
+
+struct VulkanTexture {
+	VulkanImage image;
+	VkDescriptorSet descriptorSet;
+};
+
+struct VulkanTarget {
+	std::vector<VkImage> colorImages;
+	std::vector<VkImageView> colorViews;
+	std::vector<VkImage> depthImages;
+	std::vector<VkImageView> depthViews;
+
+	VulkanImage color;
+	VulkanImage depth;
+	VulkanBuffer capture;
+};
+
+struct VulkanThreadPool {
+	VkCommandPool pool;
+	std::array<VkCommandBuffer, 2 * nodeCapacity> buffers;
+	uint32_t used;
+};
+
+struct VulkanFrame {
+	VkFence fence;
+	VkCommandPool pool;
+	VkCommandBuffer commands;
+	std::vector<VulkanThreadPool> threadPools;
+	std::array<VkCommandBuffer, nodeCapacity> nodeCommands[2];
+};
+
+struct Renderer {
+	virtual ~Renderer() = default;
+
+	virtual void setup() = 0;
+	virtual void uploadTexture(Image& image, const uint8_t* pixels) = 0;
+	virtual void setupScene() = 0;
+	virtual void attachThread() = 0;
+	virtual void detachThread() = 0;
+	virtual void renderFrame(const RenderPacket& packet) = 0;
+	virtual void clean() = 0;
+};
+
+struct GlRenderer : Renderer {
+	void setup() override;
+	void uploadTexture(Image& image, const uint8_t* pixels) override;
+	void setupScene() override;
+	void attachThread() override;
+	void detachThread() override;
+	void renderFrame(const RenderPacket& packet) override;
+	void clean() override;
 };
+
+struct VulkanRenderer : Renderer {
+	void setup() override;
+	void uploadTexture(Image& image, const uint8_t* pixels) override;
+	void setupScene() override;
+	void attachThread() override;
+	void detachThread() override;
+	void renderFrame(const RenderPacket& packet) override;
+	void clean() override;
+};
+
+// Hilda.cpp: scene, traversal, jobs, profiling and the frame loop
+
+extern GLFWwindow* window;
+
+extern std::string assetFolder;
+extern std::string shaderFolder;
+extern std::string cacheFolder;
+
+extern ovrSession session;
+extern ovrGraphicsLuid luid;
+extern ovrHmdDesc hmdDesc;
+extern ovrTimewarpProjectionDesc timewarpProjectionDesc;
+
+extern Framebuffer framebuffers[2];
+extern HiddenArea hiddenAreas[2];
+
+extern uint32_t width;
+extern uint32_t height;
+extern uint32_t portalCount;
+extern uint32_t meshCount;
+extern uint32_t nodeLimit;
+
+extern int64_t renderFrameIndex;
+extern thread_local int64_t profiledFrame;
+
+extern std::vector<GLushort> indices;
+extern std::vector<Vertex> vertices;
+extern std::vector<std::string> imageNames;
+extern std::vector<Image> textures;
+extern std::vector<Mesh> meshes;
+extern std::vector<Portal> portals;
+
+extern MeshStreams meshStreams;
+extern PortalStreams portalStreams;
+
+extern const RenderPacket* currentPacket;
+
+extern std::vector<std::unique_ptr<JobQueue>> jobQueues;
+extern thread_local uint32_t jobQueueIndex;
+
+extern bool profiling;
+extern std::atomic<uint32_t> profileCursor;
+extern std::vector<ProfileEvent> profileEvents;
+
+extern std::vector<uint8_t> capturedPixels[2];
+extern int64_t captureFrame;
+
+extern bool lensMatched;
+extern bool multires;
+extern bool gpuCulling;
+extern bool lighting;
+extern bool quantized;
+extern bool shaderCacheDisabled;
+extern bool headless;
+
+uint64_t profileTime();
+uint32_t profileFrame();
+uint32_t beginProfile(const char* name, int32_t eye, int32_t node);
+void endProfile(uint32_t index);
+
+void submitJob(std::atomic<uint32_t>& counter, std::function<void()> task);
+void waitJobs(std::atomic<uint32_t>& counter);
+
+std::string readShaderSource(std::string path);
+std::vector<char> readShaderBinary(std::string path);
+std::vector<glm::vec2> hiddenAreaVertices();
+void createWindow();
+
+bool emptyWindow(const glm::vec4& window);
+uint32_t nodePlanes(const Node& node, const glm::mat3& basis, glm::vec4 planes[5]);
+glm::mat3 viewBasis(const RenderPacket& packet, int eye);
+
+void submitFrame(const PoseRecord& record);
+void markFrameBegun(int64_t index);
+
+template <typename Task>
+void parallelFor(uint32_t count, uint32_t grain, const Task& task) {
+	std::atomic<uint32_t> counter = 0;
+
+	for (auto first = grain; first < count; first += grain) {
+		auto last = std::min(first + grain, count);
+		submitJob(counter, [&task, first, last] { task(first, last); });
+	}
+
+	if (count)
+		task(0, std::min(grain, count));
+
+	waitJobs(counter);
+}
+
+// HildaGl.cpp: the OpenGL backend
+
+extern bool multiresLayer;
+extern float_t resolutionScale;
+
+void setupResolutionScaling();
+void resolveGpuProfile(uint32_t frameSlot);
+uint32_t lensViewportWidth(const Framebuffer& framebuffer);
+uint32_t lensViewportHeight(const Framebuffer& framebuffer);
+
+// HildaGltf.cpp: the glTF importer
+
+bool mapFile(const std::string path, MappedFile& file);
+void unmapFile(MappedFile& file);
+bool readModel(GltfModel& model, const std::string name, std::string& messages);
+void closeModel(GltfModel& model);
+void loadMesh(const GltfModel& model, const std::vector<GltfPrimitive>& primitives, Type type,
+	const glm::mat4& translation, const glm::mat4& rotation, const glm::mat4& scale, uint8_t room);
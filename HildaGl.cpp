@@ -0,0 +1,1191 @@
+#include "Hilda.hpp"
+
+ovrMirrorTexture mirrorTexture;
+GLuint mirrorTextureBuffer;
+GLuint mirrorFramebuffer;
+
+int64_t gpuClockOffset;
+
+bool multiresLayer;
+
+glm::vec3 quantizationScale;
+glm::vec3 quantizationOffset;
+bool shaderCaching;
+
+uint64_t driverHash;
+uint32_t cullGroups;
+std::vector<uint32_t> textureSlots;
+std::vector<uint32_t> textureSizes;
+
+float_t resolutionScale;
+double_t gpuBudget;
+uint32_t gpuFrameTimeCount;
+std::array<bool, profileLatency> resolutionQueriesIssued;
+std::array<GLuint, profileLatency> resolutionQueries;
+std::array<double_t, resolutionHistory> gpuFrameTimes;
+
+uint32_t timerSlots;
+std::vector<GLuint> timerQueries;
+std::vector<uint32_t> timerEvents;
+std::array<uint32_t, profileLatency> timerCounts;
+
+std::vector<GLuint> portalQueries;
+
+GLuint VAO;
+GLuint VBO;
+GLuint EBO;
+GLuint UBO;
+GLuint transformStride;
+std::vector<uint8_t> transformData;
+GLuint maskVAO;
+GLuint hiddenVAO;
+GLuint hiddenVBO;
+GLuint shaderProgram;
+GLuint maskProgram;
+GLuint hiddenProgram;
+GLuint resolveVAO;
+GLuint resolveProgram;
+GLuint cullProgram;
+GLuint cullMeshBuffer;
+GLuint cullNodeBuffer;
+GLuint commandBuffer;
+GLuint countBuffer;
+
+//////////////////////////////////////////////////////////////////////////////
+
+void setupGpuProfiler() {
+	if (!profiling)
+		return;
+
+	timerSlots = 2 * (nodeLimit + 1);
+	timerQueries.resize(profileLatency * timerSlots * 2);
+	timerEvents.resize(profileLatency * timerSlots);
+	timerCounts.fill(0);
+
+	glGenQueries(static_cast<GLsizei>(timerQueries.size()), timerQueries.data());
+
+	GLint64 gpuTime;
+	glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+	gpuClockOffset = static_cast<int64_t>(profileTime()) - gpuTime;
+}
+
+uint32_t beginGpuProfile(const char* name, int32_t eye, int32_t node) {
+	if (!profiling)
+		return UINT32_MAX;
+
+	auto frameSlot = profileFrame() % profileLatency;
+	auto& count = timerCounts.at(frameSlot);
+
+	if (count == timerSlots)
+		return UINT32_MAX;
+
+	auto slot = frameSlot * timerSlots + count++;
+	auto index = profileCursor.fetch_add(1, std::memory_order_relaxed);
+
+	profileEvents.at(index % profileCapacity) = { name, profileFrame(), eye, node, true, ProfileThread::Gpu, 0, 0 };
+	timerEvents.at(slot) = index;
+
+	glQueryCounter(timerQueries.at(2 * slot), GL_TIMESTAMP);
+	return slot;
+}
+
+void endGpuProfile(uint32_t slot) {
+	if (slot != UINT32_MAX)
+		glQueryCounter(timerQueries.at(2 * slot + 1), GL_TIMESTAMP);
+}
+
+void resolveGpuProfile(uint32_t frameSlot) {
+	if (!profiling)
+		return;
+
+	auto& count = timerCounts.at(frameSlot);
+
+	for (auto slot = frameSlot * timerSlots; slot < frameSlot * timerSlots + count; slot++) {
+		GLuint64 begin, end;
+		glGetQueryObjectui64v(timerQueries.at(2 * slot), GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(timerQueries.at(2 * slot + 1), GL_QUERY_RESULT, &end);
+
+		auto& event = profileEvents.at(timerEvents.at(slot) % profileCapacity);
+		event.begin = begin + gpuClockOffset;
+		event.end = end + gpuClockOffset;
+	}
+
+	count = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void setupResolutionScaling() {
+	auto refreshRate = hmdDesc.DisplayRefreshRate > 0.0f ? hmdDesc.DisplayRefreshRate : 90.0f;
+
+	resolutionScale = defaultPixelDensity / maximumPixelDensity;
+	gpuBudget = 0.85 / refreshRate;
+	gpuFrameTimeCount = 0;
+	resolutionQueriesIssued.fill(false);
+}
+
+void setupResolutionQueries() {
+	glGenQueries(static_cast<GLsizei>(resolutionQueries.size()), resolutionQueries.data());
+}
+
+void updateResolutionScale() {
+	auto slot = renderFrameIndex % profileLatency;
+
+	if (resolutionQueriesIssued.at(slot)) {
+		GLuint64 elapsed;
+		glGetQueryObjectui64v(resolutionQueries.at(slot), GL_QUERY_RESULT, &elapsed);
+
+		gpuFrameTimes.at(gpuFrameTimeCount++ % resolutionHistory) = elapsed / 1e9;
+		resolutionQueriesIssued.at(slot) = false;
+	}
+
+	if (gpuFrameTimeCount < resolutionHistory)
+		return;
+
+	auto gpuFrameTime = 0.0;
+
+	for (auto time : gpuFrameTimes)
+		gpuFrameTime += time / resolutionHistory;
+
+	// Fragment cost follows the pixel count, so the side length scales with the square root
+	auto targetScale = resolutionScale * static_cast<float_t>(std::sqrt(gpuBudget / gpuFrameTime));
+	targetScale = std::clamp(targetScale, minimumPixelDensity / maximumPixelDensity, 1.0f);
+
+	// Drop quickly when over budget, recover slowly
+	resolutionScale += (targetScale - resolutionScale) * (targetScale < resolutionScale ? 0.5f : 0.05f);
+
+	for (int eye = 0; eye < 2; eye++) {
+		auto& framebuffer = framebuffers[eye];
+
+		framebuffer.viewportWidth = std::max(1u, static_cast<uint32_t>(framebuffer.width * resolutionScale));
+		framebuffer.viewportHeight = std::max(1u, static_cast<uint32_t>(framebuffer.height * resolutionScale));
+	}
+}
+
+void beginResolutionQuery() {
+	glBeginQuery(GL_TIME_ELAPSED, resolutionQueries.at(renderFrameIndex % profileLatency));
+}
+
+void endResolutionQuery() {
+	glEndQuery(GL_TIME_ELAPSED);
+	resolutionQueriesIssued.at(renderFrameIndex % profileLatency) = true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void captureEye(int eye) {
+	auto& framebuffer = framebuffers[eye];
+	auto& pixels = capturedPixels[eye];
+
+	pixels.resize(framebuffer.viewportWidth * framebuffer.viewportHeight * 3);
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, framebuffer.viewportWidth, framebuffer.viewportHeight, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+}
+
+void uploadGlTexture(Image& image, const uint8_t* pixels) {
+	glGenTextures(1, &image.texture);
+	glBindTexture(GL_TEXTURE_2D, image.texture);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+std::string shaderSource(std::string path, std::string header)
+{
+	auto source = readShaderSource(path);
+
+	// Headers have to follow the version directive
+	if (!header.empty())
+		source.insert(source.find('\n') + 1, header);
+
+	return source;
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 0xCBF29CE484222325u)
+{
+	auto bytes = static_cast<const uint8_t*>(data);
+
+	for (size_t index = 0; index < size; index++)
+		hash = (hash ^ bytes[index]) * 0x100000001B3u;
+
+	return hash;
+}
+
+GLuint createSpirvShader(const std::vector<char>& binary, GLenum type)
+{
+	GLuint shader = glCreateShader(type);
+	glShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V, binary.data(), static_cast<GLsizei>(binary.size()));
+	glSpecializeShader(shader, "main", 0, nullptr, nullptr);
+
+	GLint result;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
+
+	if (!result) {
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+GLuint createShader(std::string path, GLenum type, std::string header = "")
+{
+	if (header.empty()) {
+		auto binary = readShaderBinary(path + ".spv");
+
+		if (!binary.empty())
+			if (auto shader = createSpirvShader(binary, type))
+				return shader;
+	}
+
+	auto source = shaderSource(path, header);
+	auto code = source.c_str();
+
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &code, NULL);
+	glCompileShader(shader);
+
+#ifndef NDEBUG
+	GLint result;
+	GLchar log[512];
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
+
+	if (!result)
+	{
+		glGetShaderInfoLog(shader, 512, NULL, log);
+		std::cout << log << std::endl;
+	}
+#endif
+
+	return shader;
+}
+
+std::string programCachePath(const std::vector<ShaderStage>& stages)
+{
+	auto hash = driverHash;
+
+	for (auto& stage : stages) {
+		auto source = shaderSource(stage.path, stage.header);
+		auto binary = readShaderBinary(stage.path + ".spv");
+
+		hash = hashBytes(&stage.type, sizeof(stage.type), hash);
+		hash = hashBytes(source.data(), source.size(), hash);
+		hash = hashBytes(binary.data(), binary.size(), hash);
+	}
+
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(hash));
+
+	return cacheFolder + name;
+}
+
+bool loadProgramBinary(GLuint program, const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	GLenum format;
+
+	if (!file.read(reinterpret_cast<char*>(&format), sizeof(format)))
+		return false;
+
+	std::vector<char> binary{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+	glProgramBinary(program, format, binary.data(), static_cast<GLsizei>(binary.size()));
+
+	GLint result;
+	glGetProgramiv(program, GL_LINK_STATUS, &result);
+
+	return result;
+}
+
+void storeProgramBinary(GLuint program, const std::string& path)
+{
+	GLint length;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+
+	if (length <= 0)
+		return;
+
+	GLenum format;
+	std::vector<char> binary(length);
+	glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+	std::ofstream file(path, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+	file.write(binary.data(), binary.size());
+}
+
+GLuint createProgram(const std::vector<ShaderStage>& stages)
+{
+	std::string cachePath;
+
+	if (shaderCaching) {
+		cachePath = programCachePath(stages);
+
+		GLuint program = glCreateProgram();
+
+		if (loadProgramBinary(program, cachePath))
+			return program;
+
+		glDeleteProgram(program);
+	}
+
+	GLuint program = glCreateProgram();
+	std::vector<GLuint> shaders;
+
+	for (auto& stage : stages) {
+		shaders.push_back(createShader(stage.path, stage.type, stage.header));
+		glAttachShader(program, shaders.back());
+	}
+
+	glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(program);
+
+	int result;
+	glGetProgramiv(program, GL_LINK_STATUS, &result);
+
+#ifndef NDEBUG
+	char log[512];
+
+	if (!result)
+	{
+		glGetProgramInfoLog(program, 512, NULL, log);
+		std::cout << log << std::endl;
+	}
+#endif
+
+	for (auto shader : shaders) {
+		glDetachShader(program, shader);
+		glDeleteShader(shader);
+	}
+
+	if (shaderCaching && result)
+		storeProgramBinary(program, cachePath);
+
+	return program;
+}
+
+std::string variantHeader(const ShaderVariant& variant) {
+	std::string header;
+
+	if (variant.lighting)
+		header += "#define LIGHTING\n";
+
+	if (variant.maskOnly)
+		header += "#define MASK_ONLY\n";
+
+	if (variant.quantized) {
+		char constants[256];
+		std::snprintf(constants, sizeof(constants), "#define QUANTIZED\nconst vec3 quantizationScale = vec3(%.9g, %.9g, %.9g);\n"
+			"const vec3 quantizationOffset = vec3(%.9g, %.9g, %.9g);\n", quantizationScale.x, quantizationScale.y, quantizationScale.z,
+			quantizationOffset.x, quantizationOffset.y, quantizationOffset.z);
+		header += constants;
+	}
+
+	return header;
+}
+
+GLuint createVariantProgram(const ShaderVariant& variant) {
+	auto header = variantHeader(variant);
+	return createProgram({ { "vertex.vert", GL_VERTEX_SHADER, header }, { "fragment.frag", GL_FRAGMENT_SHADER, header } });
+}
+
+void setupShaderCache() {
+	GLint formatCount;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+
+	shaderCaching = !shaderCacheDisabled && formatCount > 0;
+
+	if (!shaderCaching)
+		return;
+
+	std::filesystem::create_directories(cacheFolder);
+
+	for (auto name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+		auto value = reinterpret_cast<const char*>(glGetString(name));
+		driverHash = hashBytes(value, std::strlen(value), driverHash);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void createHiddenAreas() {
+	auto hiddenVertices = hiddenAreaVertices();
+
+	glGenVertexArrays(1, &hiddenVAO);
+	glBindVertexArray(hiddenVAO);
+
+	glGenBuffers(1, &hiddenVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, hiddenVBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * hiddenVertices.size(), hiddenVertices.data(), GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (GLvoid*)0);
+	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	hiddenProgram = createProgram({ { "hidden.vert", GL_VERTEX_SHADER, "" }, { "fragment.frag", GL_FRAGMENT_SHADER, variantHeader({ false, false, true }) } });
+
+	glProgramUniformMatrix4fv(hiddenProgram, 0, 1, GL_FALSE, glm::value_ptr(glm::mat4{ 1.0f }));
+}
+
+float_t lensWarp() {
+	return multires ? multiresWarp : lensMatchedWarp;
+}
+
+float_t lensScale() {
+	return 1.0f / (1.0f + lensWarp());
+}
+
+void setupMultires() {
+	ovrBool supported = ovrFalse;
+
+	if (session && OVR_SUCCESS(ovr_IsExtensionSupported(session, ovrExtension_TextureLayout_Octilinear, &supported)) && supported)
+		multiresLayer = OVR_SUCCESS(ovr_EnableExtension(session, ovrExtension_TextureLayout_Octilinear));
+
+	if (!multiresLayer)
+		std::cout << "Octilinear layers are not available, multires frames are resolved into plain eye textures" << std::endl;
+}
+
+void createLensTargets() {
+	for (int eye = 0; eye < 2; eye++) {
+		auto& framebuffer = framebuffers[eye];
+
+		framebuffer.lensWidth = std::max(1u, static_cast<uint32_t>(framebuffer.width * lensScale()));
+		framebuffer.lensHeight = std::max(1u, static_cast<uint32_t>(framebuffer.height * lensScale()));
+
+		glGenTextures(1, &framebuffer.lensColorTexture);
+		glBindTexture(GL_TEXTURE_2D, framebuffer.lensColorTexture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_SRGB8_ALPHA8, framebuffer.lensWidth, framebuffer.lensHeight);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glGenTextures(1, &framebuffer.lensDepthStencilTexture);
+		glBindTexture(GL_TEXTURE_2D, framebuffer.lensDepthStencilTexture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH32F_STENCIL8, framebuffer.lensWidth, framebuffer.lensHeight);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glGenFramebuffers(1, &framebuffer.lensFramebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.lensFramebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, framebuffer.lensColorTexture, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, framebuffer.lensDepthStencilTexture, 0);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glGenVertexArrays(1, &resolveVAO);
+
+	auto lensHeader = "const float lensWarp = " + std::to_string(lensWarp()) + ";\n" + readShaderSource("lens.glsl");
+	resolveProgram = createProgram({ { "resolve.vert", GL_VERTEX_SHADER, "" }, { "resolve.frag", GL_FRAGMENT_SHADER, lensHeader } });
+}
+
+void setupPortalQueries() {
+	// A child is tested in the same quadrant its parent marked it
+	portalQueries.resize(2 * nodeCapacity * 4);
+	glGenQueries(static_cast<GLsizei>(portalQueries.size()), portalQueries.data());
+}
+
+void setupGpuCulling() {
+	cullProgram = createProgram({ { "cull.comp", GL_COMPUTE_SHADER, "" } });
+
+	textureSizes.assign(textures.size(), 0);
+	textureSlots.assign(textures.size(), 0);
+
+	for (auto textureIndex : meshStreams.textureIndices)
+		textureSizes[textureIndex]++;
+
+	for (auto textureIndex = 1u; textureIndex < textures.size(); textureIndex++)
+		textureSlots[textureIndex] = textureSlots[textureIndex - 1] + textureSizes[textureIndex - 1];
+
+	std::vector<CullMesh> cullEntries(meshCount);
+	auto roomMeshes = 0u;
+
+	for (auto index = 0u; index < meshCount; index++) {
+		auto& mesh = meshes[index];
+		auto textureIndex = meshStreams.textureIndices[index];
+
+		cullEntries[index] = CullMesh{ glm::vec4{ mesh.minBorders, 1.0f }, glm::vec4{ mesh.maxBorders, 1.0f }, meshStreams.indexLengths[index],
+			meshStreams.indexOffsets[index], meshStreams.vertexOffsets[index], textureIndex, textureSlots[textureIndex], {} };
+	}
+
+	for (auto room = 0u; room + 1 < meshStreams.roomOffsets.size(); room++)
+		roomMeshes = std::max(roomMeshes, meshStreams.roomOffsets[room + 1] - meshStreams.roomOffsets[room]);
+
+	cullGroups = (roomMeshes + cullGroupSize - 1) / cullGroupSize;
+
+	glGenBuffers(1, &cullMeshBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cullMeshBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(CullMesh) * cullEntries.size(), cullEntries.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &cullNodeBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cullNodeBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(CullNode) * nodeCapacity, nullptr, GL_DYNAMIC_DRAW);
+
+	glGenBuffers(1, &commandBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawCommand) * meshCount * nodeCapacity, nullptr, GL_DYNAMIC_COPY);
+
+	glGenBuffers(1, &countBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * textures.size() * nodeCapacity, nullptr, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, cullMeshBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, cullNodeBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, countBuffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glBindBuffer(GL_PARAMETER_BUFFER, countBuffer);
+
+	glProgramUniform1ui(cullProgram, 0, meshCount);
+	glProgramUniform1ui(cullProgram, 1, static_cast<GLuint>(textures.size()));
+}
+
+void setupQuantization() {
+	auto min = glm::vec3{ std::numeric_limits<float_t>::max() }, max = glm::vec3{ -std::numeric_limits<float_t>::max() };
+
+	for (auto& vertex : vertices) {
+		min = glm::min(min, vertex.position);
+		max = glm::max(max, vertex.position);
+	}
+
+	quantizationOffset = 0.5f * (min + max);
+	quantizationScale = glm::max(0.5f * (max - min), glm::vec3{ epsilon });
+}
+
+std::vector<QuantizedVertex> quantizeVertices() {
+	std::vector<QuantizedVertex> quantizedVertices(vertices.size());
+
+	for (auto index = 0u; index < vertices.size(); index++) {
+		auto& vertex = vertices[index];
+		auto& quantizedVertex = quantizedVertices[index];
+		auto position = glm::round(glm::clamp((vertex.position - quantizationOffset) / quantizationScale, -1.0f, 1.0f) * 32767.0f);
+		auto normal = glm::round(glm::clamp(vertex.normal, -1.0f, 1.0f) * 127.0f);
+
+		for (auto axis = 0; axis < 3; axis++) {
+			quantizedVertex.position[axis] = static_cast<int16_t>(position[axis]);
+			quantizedVertex.normal[axis] = static_cast<int8_t>(normal[axis]);
+		}
+
+		quantizedVertex.position[3] = 0;
+		quantizedVertex.normal[3] = 0;
+		quantizedVertex.texture[0] = glm::packHalf1x16(vertex.texture.x);
+		quantizedVertex.texture[1] = glm::packHalf1x16(vertex.texture.y);
+	}
+
+	return quantizedVertices;
+}
+
+void setVertexLayout(bool positionOnly) {
+	if (quantized) {
+		glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(QuantizedVertex), (GLvoid*)offsetof(QuantizedVertex, position));
+		glEnableVertexAttribArray(0);
+
+		if (positionOnly)
+			return;
+
+		glVertexAttribPointer(1, 3, GL_BYTE, GL_TRUE, sizeof(QuantizedVertex), (GLvoid*)offsetof(QuantizedVertex, normal));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(QuantizedVertex), (GLvoid*)offsetof(QuantizedVertex, texture));
+		glEnableVertexAttribArray(2);
+	}
+
+	else {
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+		glEnableVertexAttribArray(0);
+
+		if (positionOnly)
+			return;
+
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)sizeof(glm::vec3));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)(2 * sizeof(glm::vec3)));
+		glEnableVertexAttribArray(2);
+	}
+}
+
+void setupGl() {
+	glfwInit();
+
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_VISIBLE, headless ? GLFW_FALSE : GLFW_TRUE);
+	//glfwWindowHint(GLFW_TRANSPARENT_FRAMEBUFFER, 1);
+
+	createWindow();
+	glfwMakeContextCurrent(window);
+	glfwSwapInterval(0);
+
+	gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+}
+
+void createGlSwapchains() {
+	for (int eye = 0; eye < 2; eye++) {
+		auto& framebuffer = framebuffers[eye];
+
+		ovrTextureSwapChainDesc desc = {};
+		desc.Type = ovrTexture_2D;
+		desc.ArraySize = 1;
+		desc.Width = framebuffer.width;
+		desc.Height = framebuffer.height;
+		desc.MipLevels = 1;
+		desc.SampleCount = 1;
+		desc.StaticImage = ovrFalse;
+
+		int length;
+
+		desc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+
+		ovr_CreateTextureSwapChainGL(session, &desc, &framebuffer.textureSwapchain);
+		ovr_GetTextureSwapChainLength(session, framebuffer.textureSwapchain, &length);
+
+		for (int i = 0; i < length; i++)
+		{
+			GLuint textureIndex;
+			ovr_GetTextureSwapChainBufferGL(session, framebuffer.textureSwapchain, i, &textureIndex);
+			glBindTexture(GL_TEXTURE_2D, textureIndex);
+
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+
+		desc.Format = OVR_FORMAT_D32_FLOAT_S8X24_UINT;
+
+		ovr_CreateTextureSwapChainGL(session, &desc, &framebuffer.depthStencilSwapchain);
+		ovr_GetTextureSwapChainLength(session, framebuffer.depthStencilSwapchain, &length);
+
+		for (int i = 0; i < length; ++i)
+		{
+			GLuint textureIndex;
+			ovr_GetTextureSwapChainBufferGL(session, framebuffer.depthStencilSwapchain, i, &textureIndex);
+			glBindTexture(GL_TEXTURE_2D, textureIndex);
+
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+
+		glGenFramebuffers(1, &framebuffer.framebuffer);
+	}
+
+	ovrMirrorTextureDesc mirrorDescriptor{};
+	mirrorDescriptor.Width = width;
+	mirrorDescriptor.Height = width;
+	mirrorDescriptor.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+
+	ovr_CreateMirrorTextureWithOptionsGL(session, &mirrorDescriptor, &mirrorTexture);
+	ovr_GetMirrorTextureBufferGL(session, mirrorTexture, &mirrorTextureBuffer);
+
+	glGenFramebuffers(1, &mirrorFramebuffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, mirrorFramebuffer);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mirrorTextureBuffer, 0);
+	glFramebufferRenderbuffer(GL_READ_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+void createGlTargets() {
+	for (int eye = 0; eye < 2; eye++) {
+		auto& framebuffer = framebuffers[eye];
+
+		glGenTextures(1, &framebuffer.colorTexture);
+		glBindTexture(GL_TEXTURE_2D, framebuffer.colorTexture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_SRGB8_ALPHA8, framebuffer.width, framebuffer.height);
+
+		glGenTextures(1, &framebuffer.depthStencilTexture);
+		glBindTexture(GL_TEXTURE_2D, framebuffer.depthStencilTexture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH32F_STENCIL8, framebuffer.width, framebuffer.height);
+
+		glGenFramebuffers(1, &framebuffer.framebuffer);
+	}
+}
+
+void setupGlScene() {
+	glEnable(GL_FRAMEBUFFER_SRGB);
+	glEnable(GL_CULL_FACE);
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_STENCIL_TEST);
+	glEnable(GL_SCISSOR_TEST);
+
+	glFrontFace(GL_CCW);
+	glCullFace(GL_BACK);
+
+	glDepthMask(GL_TRUE);
+	glDepthFunc(GL_LESS);
+
+	glClearDepth(1.0f);
+	glClearStencil(0);
+	glClearColor(0.4f, 0.8f, 1.0f, 1.0f);
+
+	setupGpuProfiler();
+	setupResolutionQueries();
+
+	if (session)
+		createGlSwapchains();
+	else
+		createGlTargets();
+	setupShaderCache();
+
+	if (multires)
+		lensMatched = false;
+
+	if (quantized)
+		setupQuantization();
+
+	shaderProgram = createVariantProgram({ lighting, quantized, false });
+	glUseProgram(shaderProgram);
+
+	glGenVertexArrays(1, &VAO);
+	glBindVertexArray(VAO);
+
+	glGenBuffers(1, &VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+
+	if (quantized) {
+		auto quantizedVertices = quantizeVertices();
+		glBufferData(GL_ARRAY_BUFFER, sizeof(QuantizedVertex) * quantizedVertices.size(), quantizedVertices.data(), GL_STATIC_DRAW);
+	}
+
+	else
+		glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
+
+	setVertexLayout(false);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &EBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * indices.size(), indices.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &UBO);
+	glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+	glUniformBlockBinding(shaderProgram, 0, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, UBO);
+
+	GLint alignment;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+	transformStride = (sizeof(OVR::Matrix4f) + alignment - 1) / alignment * alignment;
+	transformData.resize(2 * nodeCapacity * 4 * transformStride);
+	glBufferData(GL_UNIFORM_BUFFER, transformData.size(), nullptr, GL_DYNAMIC_DRAW);
+
+	maskProgram = createVariantProgram({ false, quantized, true });
+	glUniformBlockBinding(maskProgram, 0, 0);
+
+	glGenVertexArrays(1, &maskVAO);
+	glBindVertexArray(maskVAO);
+
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	setVertexLayout(true);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
+	createHiddenAreas();
+
+	if (multires)
+		setupMultires();
+
+	if (lensMatched || (multires && !multiresLayer))
+		createLensTargets();
+
+	setupPortalQueries();
+
+	if (gpuCulling)
+		setupGpuCulling();
+
+	glUseProgram(shaderProgram);
+	glBindVertexArray(VAO);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void drawMesh(uint32_t meshIndex) {
+	glBindTexture(GL_TEXTURE_2D, textures[meshStreams.textureIndices[meshIndex]].texture);
+	glDrawElementsBaseVertex(GL_TRIANGLES, meshStreams.indexLengths[meshIndex], GL_UNSIGNED_SHORT,
+		(GLvoid*)(meshStreams.indexOffsets[meshIndex] * sizeof(GLushort)), meshStreams.vertexOffsets[meshIndex]);
+}
+
+void drawCulledMeshes(uint8_t nodeIndex) {
+	auto textureCount = static_cast<uint32_t>(textures.size());
+
+	for (auto textureIndex = 0u; textureIndex < textureCount; textureIndex++) {
+		if (!textureSizes[textureIndex])
+			continue;
+
+		glBindTexture(GL_TEXTURE_2D, textures[textureIndex].texture);
+		glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_SHORT,
+			(GLvoid*)((nodeIndex * meshCount + textureSlots[textureIndex]) * sizeof(DrawCommand)),
+			(GLintptr)((nodeIndex * textureCount + textureIndex) * sizeof(GLuint)), textureSizes[textureIndex], 0);
+	}
+}
+
+void drawMask(uint32_t portalIndex) {
+	glDrawElementsBaseVertex(GL_TRIANGLES, portalStreams.indexLengths[portalIndex], GL_UNSIGNED_SHORT,
+		(GLvoid*)(portalStreams.indexOffsets[portalIndex] * sizeof(GLushort)), portalStreams.vertexOffsets[portalIndex]);
+}
+
+void beginMaskPass() {
+	glUseProgram(maskProgram);
+	glBindVertexArray(maskVAO);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+}
+
+void endMaskPass() {
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glBindVertexArray(VAO);
+	glUseProgram(shaderProgram);
+}
+
+void drawHiddenArea(int eye) {
+	auto& hiddenArea = hiddenAreas[eye];
+
+	glUseProgram(hiddenProgram);
+	glBindVertexArray(hiddenVAO);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDisable(GL_CULL_FACE);
+
+	glDrawArrays(GL_TRIANGLES, hiddenArea.first, hiddenArea.count);
+
+	glEnable(GL_CULL_FACE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glBindVertexArray(VAO);
+	glUseProgram(shaderProgram);
+}
+
+uint32_t lensViewportWidth(const Framebuffer& framebuffer) {
+	return std::max(1u, static_cast<uint32_t>(framebuffer.viewportWidth * lensScale()));
+}
+
+uint32_t lensViewportHeight(const Framebuffer& framebuffer) {
+	return std::max(1u, static_cast<uint32_t>(framebuffer.viewportHeight * lensScale()));
+}
+
+bool usesLensTarget() {
+	return lensMatched || (multires && !multiresLayer);
+}
+
+OVR::Matrix4f quadrantWarp(uint32_t quadrant) {
+	auto signX = quadrant & 1 ? 1.0f : -1.0f;
+	auto signY = quadrant & 2 ? 1.0f : -1.0f;
+	auto warp = lensWarp();
+	auto scale = 1.0f + warp;
+
+	// Clip w grows linearly away from the center, which is linear again inside a single quadrant
+	return OVR::Matrix4f(
+		scale, 0.0f, 0.0f, 0.0f,
+		0.0f, scale, 0.0f, 0.0f,
+		0.0f, 0.0f, 1.0f, 0.0f,
+		signX * warp, signY * warp, 0.0f, 1.0f);
+}
+
+void resolveLens(int eye) {
+	auto& framebuffer = framebuffers[eye];
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.framebuffer);
+	glViewport(0, 0, framebuffer.viewportWidth, framebuffer.viewportHeight);
+	glScissor(0, 0, framebuffer.viewportWidth, framebuffer.viewportHeight);
+
+	glUseProgram(resolveProgram);
+	glBindVertexArray(resolveVAO);
+	glUniform2f(0, float_t(lensViewportWidth(framebuffer)) / framebuffer.lensWidth, float_t(lensViewportHeight(framebuffer)) / framebuffer.lensHeight);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, framebuffer.lensDepthStencilTexture);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, framebuffer.lensColorTexture);
+
+	glDisable(GL_STENCIL_TEST);
+	glDepthFunc(GL_ALWAYS);
+
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+
+	glDepthFunc(GL_LESS);
+	glEnable(GL_STENCIL_TEST);
+
+	glBindVertexArray(VAO);
+	glUseProgram(shaderProgram);
+}
+
+GLuint portalQuery(int eye, uint8_t nodeIndex, uint32_t quadrant) {
+	return portalQueries.at((eye * nodeCapacity + nodeIndex) * 4 + quadrant);
+}
+
+void drawNodeView(int eye, uint8_t nodeIndex, uint32_t quadrant) {
+	auto& node = currentPacket->nodes[eye].at(nodeIndex);
+	auto commands = currentPacket->commandLists[eye].data() + node.commandOffset;
+
+	for (auto index = 0u; index < node.commandCount; index++) {
+		auto& command = commands[index];
+		auto& arguments = command.arguments;
+
+		switch (command.type) {
+		case Command::ClearDepth:
+			glClear(GL_DEPTH_BUFFER_BIT);
+			break;
+		case Command::HiddenArea:
+			drawHiddenArea(eye);
+			break;
+		case Command::Stencil:
+			glStencilFunc(arguments[0] ? GL_EQUAL : GL_ALWAYS, arguments[1], arguments[2]);
+			glStencilMask(arguments[3]);
+			break;
+		case Command::StencilReplace:
+			glStencilOp(GL_KEEP, GL_KEEP, arguments[0] ? GL_REPLACE : GL_KEEP);
+			break;
+		case Command::DrawMesh:
+			drawMesh(arguments[0]);
+			break;
+		case Command::DrawCulled:
+			drawCulledMeshes(arguments[0]);
+			break;
+		case Command::BeginMask:
+			beginMaskPass();
+			break;
+		case Command::DrawMask:
+			glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, portalQuery(eye, arguments[1], quadrant));
+			drawMask(arguments[0]);
+			glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+			break;
+		case Command::EndMask:
+			endMaskPass();
+			break;
+		case Command::BeginConditional:
+			glBeginConditionalRender(portalQuery(eye, arguments[0], quadrant), GL_QUERY_WAIT);
+			break;
+		case Command::EndConditional:
+			glEndConditionalRender();
+			break;
+		}
+	}
+}
+
+void cullOnGpu(int eye) {
+	auto& eyeNodes = currentPacket->nodes[eye];
+	auto basis = viewBasis(*currentPacket, eye);
+	std::array<CullNode, nodeCapacity> cullNodes;
+
+	for (uint8_t index = 0; index < eyeNodes.size(); index++) {
+		auto& node = eyeNodes.at(index);
+		auto& cullNode = cullNodes[index];
+
+		cullNode.first = meshStreams.roomOffsets[node.room];
+		cullNode.count = emptyWindow(node.window) ? 0 : meshStreams.roomOffsets[node.room + 1] - cullNode.first;
+		cullNode.planeCount = nodePlanes(node, basis, cullNode.planes);
+	}
+
+	glNamedBufferSubData(cullNodeBuffer, 0, sizeof(CullNode) * eyeNodes.size(), cullNodes.data());
+	glClearNamedBufferData(countBuffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+	glUseProgram(cullProgram);
+	glDispatchCompute(cullGroups, static_cast<GLuint>(eyeNodes.size()), 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+	glUseProgram(shaderProgram);
+}
+
+GLintptr transformOffset(int eye, uint8_t nodeIndex, uint32_t quadrant) {
+	return ((eye * nodeCapacity + nodeIndex) * 4 + quadrant) * transformStride;
+}
+
+void renderEye(int eye) {
+	auto& framebuffer = framebuffers[eye];
+	auto& eyeNodes = currentPacket->nodes[eye];
+
+	GLuint curColorTexId = framebuffer.colorTexture;
+	GLuint curDepthTexId = framebuffer.depthStencilTexture;
+
+	int curIndex;
+
+	if (session) {
+		ovr_GetTextureSwapChainCurrentIndex(session, framebuffer.textureSwapchain, &curIndex);
+		ovr_GetTextureSwapChainBufferGL(session, framebuffer.textureSwapchain, curIndex, &curColorTexId);
+
+		ovr_GetTextureSwapChainCurrentIndex(session, framebuffer.depthStencilSwapchain, &curIndex);
+		ovr_GetTextureSwapChainBufferGL(session, framebuffer.depthStencilSwapchain, curIndex, &curDepthTexId);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, curColorTexId, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, curDepthTexId, 0);
+
+	if (usesLensTarget())
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.lensFramebuffer);
+
+	auto renderWidth = lensMatched || multires ? lensViewportWidth(framebuffer) : framebuffer.viewportWidth;
+	auto renderHeight = lensMatched || multires ? lensViewportHeight(framebuffer) : framebuffer.viewportHeight;
+
+	glViewport(0, 0, renderWidth, renderHeight);
+	glScissor(0, 0, renderWidth, renderHeight);
+
+	auto eyeProfile = beginProfile("eye", eye, -1);
+	auto eyeGpuProfile = beginGpuProfile("eye", eye, -1);
+
+	glStencilMask(0xFF);
+	glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+
+	if (gpuCulling) {
+		auto cullProfile = beginProfile("culling", eye, -1);
+		cullOnGpu(eye);
+		endProfile(cullProfile);
+	}
+
+	OVR::Matrix4f proj = ovrMatrix4f_Projection(hmdDesc.DefaultEyeFov[eye], 0.01f, 1000.0f, ovrProjection_None);
+	timewarpProjectionDesc = ovrTimewarpProjectionDesc_FromProjection(proj, ovrProjection_None);
+
+	auto quadrants = lensMatched || multires ? 4u : 1u;
+
+	for (uint8_t index = 0; index < eyeNodes.size(); index++) {
+		auto& node = eyeNodes.at(index);
+
+		OVR::Vector3f nodeEyePos(node.translation.x, node.translation.y, node.translation.z);
+		OVR::Matrix4f view = OVR::Matrix4f::LookAtRH(nodeEyePos, nodeEyePos + currentPacket->forwardVectors[eye], currentPacket->upVectors[eye]);
+
+		for (auto quadrant = 0u; quadrant < quadrants; quadrant++) {
+			auto transform = lensMatched || multires ? quadrantWarp(quadrant) * proj * view : proj * view;
+			transform.Transpose();
+
+			std::memcpy(transformData.data() + transformOffset(eye, index, quadrant), &transform, sizeof(transform));
+		}
+	}
+
+	auto eyeOffset = transformOffset(eye, 0, 0);
+	glBufferSubData(GL_UNIFORM_BUFFER, eyeOffset, transformOffset(eye + 1, 0, 0) - eyeOffset, transformData.data() + eyeOffset);
+
+	for (uint8_t index = 0; index < eyeNodes.size(); index++) {
+		auto nodeProfile = beginProfile("node", eye, index);
+		auto nodeGpuProfile = beginGpuProfile("node", eye, index);
+
+		if (lensMatched || multires) {
+			for (auto quadrant = 0u; quadrant < 4; quadrant++) {
+				auto warp = quadrantWarp(quadrant);
+				warp.Transpose();
+
+				auto left = quadrant & 1 ? renderWidth / 2 : 0, bottom = quadrant & 2 ? renderHeight / 2 : 0;
+				glScissor(left, bottom, quadrant & 1 ? renderWidth - renderWidth / 2 : renderWidth / 2,
+					quadrant & 2 ? renderHeight - renderHeight / 2 : renderHeight / 2);
+
+				glBindBufferRange(GL_UNIFORM_BUFFER, 0, UBO, transformOffset(eye, index, quadrant), sizeof(OVR::Matrix4f));
+				glProgramUniformMatrix4fv(hiddenProgram, 0, 1, GL_FALSE, (GLfloat*)&warp);
+
+				drawNodeView(eye, index, quadrant);
+			}
+
+			glScissor(0, 0, renderWidth, renderHeight);
+		}
+
+		else {
+			glBindBufferRange(GL_UNIFORM_BUFFER, 0, UBO, transformOffset(eye, index, 0), sizeof(OVR::Matrix4f));
+			drawNodeView(eye, index, 0);
+		}
+
+		endGpuProfile(nodeGpuProfile);
+		endProfile(nodeProfile);
+	}
+
+	if (usesLensTarget())
+		resolveLens(eye);
+
+	endGpuProfile(eyeGpuProfile);
+	endProfile(eyeProfile);
+
+	if (renderFrameIndex == captureFrame)
+		captureEye(eye);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+
+	if (session) {
+		ovr_CommitTextureSwapChain(session, framebuffer.textureSwapchain);
+		ovr_CommitTextureSwapChain(session, framebuffer.depthStencilSwapchain);
+	}
+}
+
+void renderGlFrame(const RenderPacket& packet) {
+	currentPacket = &packet;
+	renderFrameIndex = packet.frameIndex;
+	profiledFrame = packet.frameIndex;
+
+	auto frameProfile = beginProfile("render", -1, -1);
+
+	resolveGpuProfile(profileFrame() % profileLatency);
+
+	if (packet.visible) {
+		if (session)
+			ovr_BeginFrame(session, renderFrameIndex);
+
+		markFrameBegun(renderFrameIndex);
+
+		// Headless runs keep the default density so captures compare between backends
+		if (!headless)
+			updateResolutionScale();
+
+		beginResolutionQuery();
+
+		glBufferData(GL_UNIFORM_BUFFER, transformData.size(), nullptr, GL_DYNAMIC_DRAW);
+
+		for (int eye = 0; eye < 2; eye++)
+			renderEye(eye);
+
+		endResolutionQuery();
+
+		if (session)
+			submitFrame(packet.record);
+	}
+
+	else
+		markFrameBegun(renderFrameIndex);
+
+	if (session) {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, mirrorFramebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+		glBlitFramebuffer(0, height, width, 0, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		glfwSwapBuffers(window);
+	}
+
+	endProfile(frameProfile);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void GlRenderer::setup() {
+	setupGl();
+}
+
+void GlRenderer::uploadTexture(Image& image, const uint8_t* pixels) {
+	uploadGlTexture(image, pixels);
+}
+
+void GlRenderer::setupScene() {
+	setupGlScene();
+}
+
+void GlRenderer::attachThread() {
+	glfwMakeContextCurrent(window);
+}
+
+void GlRenderer::detachThread() {
+	glfwMakeContextCurrent(nullptr);
+}
+
+void GlRenderer::renderFrame(const RenderPacket& packet) {
+	renderGlFrame(packet);
+}
+
+void GlRenderer::clean() {
+}
@@ -0,0 +1,563 @@
+#include "Hilda.hpp"
+
+#include <tinygltf/json.hpp>
+
+void unmapFile(MappedFile& file) {
+#ifdef _WIN32
+	if (file.data)
+		UnmapViewOfFile(file.data);
+	if (file.mapping)
+		CloseHandle(file.mapping);
+	if (file.file && file.file != INVALID_HANDLE_VALUE)
+		CloseHandle(file.file);
+#else
+	if (file.data)
+		munmap(const_cast<uint8_t*>(file.data), file.size);
+#endif
+
+	file = MappedFile{};
+}
+
+bool mapFile(const std::string path, MappedFile& file) {
+	file = MappedFile{};
+
+#ifdef _WIN32
+	file.file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+	if (file.file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(file.file, &size);
+	file.size = static_cast<size_t>(size.QuadPart);
+
+	if (file.size) {
+		file.mapping = CreateFileMappingA(file.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		file.data = file.mapping ? static_cast<const uint8_t*>(MapViewOfFile(file.mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+	}
+#else
+	auto descriptor = open(path.c_str(), O_RDONLY);
+
+	if (descriptor < 0)
+		return false;
+
+	struct stat status;
+	fstat(descriptor, &status);
+	file.size = static_cast<size_t>(status.st_size);
+
+	if (file.size) {
+		auto address = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		file.data = address == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(address);
+	}
+
+	close(descriptor);
+#endif
+
+	if (file.size && !file.data) {
+		unmapFile(file);
+		return false;
+	}
+
+	return true;
+}
+
+struct GltfSegment {
+	std::string key;
+	uint32_t index;
+};
+
+struct GltfFrame {
+	bool array;
+	uint32_t count;
+	std::string key;
+};
+
+// Fills a GltfModel straight from parser events, the document is never built as a tree
+struct GltfHandler {
+	GltfModel& model;
+	std::string error{};
+
+	std::vector<GltfFrame> frames{};
+	std::vector<GltfSegment> path{};
+
+	template <typename Type>
+	static Type& grow(std::vector<Type>& items, uint32_t index, const Type& fallback) {
+		if (items.size() <= index)
+			items.resize(index + 1, fallback);
+
+		return items[index];
+	}
+
+	GltfSegment next() {
+		if (frames.empty())
+			return GltfSegment{};
+
+		auto& frame = frames.back();
+		return frame.array ? GltfSegment{ "", frame.count++ } : GltfSegment{ frame.key, 0 };
+	}
+
+	void assign(const GltfSegment& field, double number, const std::string* text) {
+		if (path.size() < 2)
+			return;
+
+		auto& section = path[0].key;
+		auto item = path[1].index;
+		auto& key = field.key;
+		auto integer = static_cast<int32_t>(number);
+
+		if (path.size() == 2) {
+			if (section == "accessors") {
+				auto& accessor = grow(model.accessors, item, GltfAccessor{ -1, 0, 0, 1, false, 0 });
+
+				if (key == "bufferView")
+					accessor.bufferView = integer;
+				else if (key == "byteOffset")
+					accessor.byteOffset = static_cast<uint64_t>(number);
+				else if (key == "componentType")
+					accessor.componentType = static_cast<uint32_t>(number);
+				else if (key == "count")
+					accessor.count = static_cast<uint64_t>(number);
+				else if (key == "normalized")
+					accessor.normalized = number != 0.0;
+				else if (key == "type" && text)
+					accessor.componentCount = *text == "SCALAR" ? 1 : *text == "VEC2" ? 2 : *text == "VEC3" ? 3 : *text == "VEC4" || *text == "MAT2" ? 4 :
+						*text == "MAT3" ? 9 : 16;
+			}
+
+			else if (section == "bufferViews") {
+				auto& view = grow(model.views, item, GltfView{ -1, 0, 0, 0 });
+
+				if (key == "buffer")
+					view.buffer = integer;
+				else if (key == "byteOffset")
+					view.byteOffset = static_cast<uint64_t>(number);
+				else if (key == "byteLength")
+					view.byteLength = static_cast<uint64_t>(number);
+				else if (key == "byteStride")
+					view.byteStride = static_cast<uint64_t>(number);
+			}
+
+			else if (section == "buffers") {
+				auto& uri = grow(model.bufferUris, item, std::string{});
+
+				if (key == "uri" && text)
+					uri = *text;
+			}
+
+			else if (section == "textures") {
+				auto& source = grow(model.textureSources, item, -1);
+
+				if (key == "source")
+					source = integer;
+			}
+
+			else if (section == "images") {
+				auto& name = grow(model.imageNames, item, std::string{});
+
+				if (key == "name" && text)
+					name = *text;
+				else if (key == "uri" && text && name.empty())
+					name = std::filesystem::path(*text).stem().string();
+			}
+
+			else if (section == "materials")
+				grow(model.materialTextures, item, -1);
+
+			else if (section == "meshes")
+				grow(model.meshes, item, std::vector<GltfPrimitive>{});
+
+			else if (section == "nodes") {
+				auto& node = grow(model.nodes, item, GltfNode{ -1, glm::vec3{ 0.0f }, glm::quat{ 1.0f, 0.0f, 0.0f, 0.0f }, glm::vec3{ 1.0f } });
+
+				if (key == "mesh")
+					node.mesh = integer;
+			}
+		}
+
+		else if (path.size() == 3 && section == "nodes" && item < model.nodes.size() && field.index < 4) {
+			auto& node = model.nodes[item];
+			auto& property = path[2].key;
+
+			if (property == "translation" && field.index < 3)
+				node.translation[field.index] = static_cast<float_t>(number);
+			else if (property == "rotation")
+				node.rotation[field.index] = static_cast<float_t>(number);
+			else if (property == "scale" && field.index < 3)
+				node.scale[field.index] = static_cast<float_t>(number);
+		}
+
+		else if (path.size() == 4 && section == "materials" && item < model.materialTextures.size() && path[2].key == "pbrMetallicRoughness" &&
+			path[3].key == "baseColorTexture" && key == "index")
+			model.materialTextures[item] = integer;
+
+		else if (path.size() >= 4 && section == "meshes" && item < model.meshes.size() && path[2].key == "primitives") {
+			auto& primitive = grow(model.meshes[item], path[3].index, GltfPrimitive{ -1, -1, -1, -1, -1 });
+
+			if (path.size() == 4 && key == "indices")
+				primitive.indices = integer;
+			else if (path.size() == 4 && key == "material")
+				primitive.material = integer;
+			else if (path.size() == 5 && path[4].key == "attributes") {
+				if (key == "POSITION")
+					primitive.position = integer;
+				else if (key == "NORMAL")
+					primitive.normal = integer;
+				else if (key == "TEXCOORD_0")
+					primitive.texture = integer;
+			}
+		}
+	}
+
+	bool value(double number, const std::string* text) {
+		assign(next(), number, text);
+		return true;
+	}
+
+	bool open(bool array) {
+		if (!frames.empty()) {
+			path.push_back(next());
+
+			if (path.size() == 2)
+				assign(GltfSegment{}, 0.0, nullptr);
+		}
+
+		frames.push_back(GltfFrame{ array, 0, "" });
+		return true;
+	}
+
+	bool close() {
+		frames.pop_back();
+
+		if (!path.empty() && frames.size() <= path.size())
+			path.pop_back();
+
+		return true;
+	}
+
+	bool null() { return value(0.0, nullptr); }
+	bool boolean(bool flag) { return value(flag ? 1.0 : 0.0, nullptr); }
+	bool number_integer(int64_t number) { return value(static_cast<double>(number), nullptr); }
+	bool number_unsigned(uint64_t number) { return value(static_cast<double>(number), nullptr); }
+	bool number_float(double number, const std::string&) { return value(number, nullptr); }
+	bool string(std::string& text) { return value(0.0, &text); }
+	bool key(std::string& text) { frames.back().key = text; return true; }
+	bool start_object(size_t) { return open(false); }
+	bool end_object() { return close(); }
+	bool start_array(size_t) { return open(true); }
+	bool end_array() { return close(); }
+
+	bool parse_error(size_t position, const std::string&, const nlohmann::detail::exception& exception) {
+		error = "at byte " + std::to_string(position) + ": " + exception.what();
+		return false;
+	}
+};
+
+//////////////////////////////////////////////////////////////////////////////
+
+uint32_t componentSize(uint32_t componentType) {
+	switch (componentType) {
+	case TINYGLTF_COMPONENT_TYPE_BYTE:
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+		return 1;
+	case TINYGLTF_COMPONENT_TYPE_SHORT:
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+		return 2;
+	default:
+		return 4;
+	}
+}
+
+float_t readComponent(const uint8_t* data, uint32_t componentType, bool normalized) {
+	switch (componentType) {
+	case TINYGLTF_COMPONENT_TYPE_BYTE: {
+		int8_t value;
+		std::memcpy(&value, data, sizeof(value));
+		return normalized ? std::max(value / 127.0f, -1.0f) : value;
+	}
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+		return normalized ? data[0] / 255.0f : data[0];
+	case TINYGLTF_COMPONENT_TYPE_SHORT: {
+		int16_t value;
+		std::memcpy(&value, data, sizeof(value));
+		return normalized ? std::max(value / 32767.0f, -1.0f) : value;
+	}
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+		uint16_t value;
+		std::memcpy(&value, data, sizeof(value));
+		return normalized ? value / 65535.0f : value;
+	}
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: {
+		uint32_t value;
+		std::memcpy(&value, data, sizeof(value));
+		return static_cast<float_t>(value);
+	}
+	default: {
+		float_t value;
+		std::memcpy(&value, data, sizeof(value));
+		return value;
+	}
+	}
+}
+
+uint32_t readIndex(const uint8_t* data, uint32_t componentType) {
+	switch (componentType) {
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+		return data[0];
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+		uint16_t value;
+		std::memcpy(&value, data, sizeof(value));
+		return value;
+	}
+	default: {
+		uint32_t value;
+		std::memcpy(&value, data, sizeof(value));
+		return value;
+	}
+	}
+}
+
+uint64_t accessorStride(const GltfModel& model, const GltfAccessor& accessor) {
+	auto& view = model.views[accessor.bufferView];
+	return view.byteStride ? view.byteStride : componentSize(accessor.componentType) * accessor.componentCount;
+}
+
+bool validAccessor(const GltfModel& model, int32_t accessorIndex, uint32_t componentCount) {
+	if (accessorIndex < 0 || accessorIndex >= static_cast<int32_t>(model.accessors.size()))
+		return false;
+
+	auto& accessor = model.accessors[accessorIndex];
+
+	if (accessor.componentCount < componentCount || accessor.bufferView < 0 || accessor.bufferView >= static_cast<int32_t>(model.views.size()))
+		return false;
+
+	auto& view = model.views[accessor.bufferView];
+
+	if (view.buffer < 0 || view.buffer >= static_cast<int32_t>(model.buffers.size()))
+		return false;
+
+	auto size = model.buffers[view.buffer].size;
+	auto elementSize = componentSize(accessor.componentType) * accessor.componentCount;
+
+	// The first check keeps the end offset from overflowing
+	return !accessor.count || (accessor.count <= size && view.byteOffset + accessor.byteOffset + accessorStride(model, accessor) * (accessor.count - 1) + elementSize <= size);
+}
+
+const uint8_t* accessorData(const GltfModel& model, int32_t accessorIndex, uint64_t& stride) {
+	auto& accessor = model.accessors[accessorIndex];
+	auto& view = model.views[accessor.bufferView];
+
+	stride = accessorStride(model, accessor);
+	return model.buffers[view.buffer].data + view.byteOffset + accessor.byteOffset;
+}
+
+std::string checkPrimitive(const GltfModel& model, const GltfPrimitive& primitive) {
+	if (!validAccessor(model, primitive.position, 3) || (primitive.normal >= 0 && !validAccessor(model, primitive.normal, 3)) ||
+		(primitive.texture >= 0 && !validAccessor(model, primitive.texture, 2)))
+		return "has an invalid vertex accessor";
+
+	if (primitive.material >= static_cast<int32_t>(model.materialTextures.size()))
+		return "has an invalid material";
+
+	if (primitive.material >= 0 && model.materialTextures[primitive.material] >= 0) {
+		auto texture = model.materialTextures[primitive.material];
+
+		if (texture >= static_cast<int32_t>(model.textureSources.size()))
+			return "has a material with an invalid texture";
+
+		auto image = model.textureSources[texture];
+
+		if (image < 0 || image >= static_cast<int32_t>(model.imageNames.size()))
+			return "has a material texture without an image";
+	}
+
+	// Indices are relative to each mesh's base vertex, a primitive only has to fit 16-bit indices on its own
+	auto vertexCount = model.accessors[primitive.position].count;
+
+	if (primitive.indices < 0)
+		return vertexCount <= std::numeric_limits<GLushort>::max() + 1ull ? "" : "has more vertices than 16-bit indices can address";
+
+	if (!validAccessor(model, primitive.indices, 1))
+		return "has an invalid index accessor";
+
+	auto& accessor = model.accessors[primitive.indices];
+
+	if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE && accessor.componentType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT &&
+		accessor.componentType != TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT)
+		return "has an invalid index accessor";
+
+	uint64_t stride;
+	auto data = accessorData(model, primitive.indices, stride);
+
+	for (auto index = 0ull; index < accessor.count; index++) {
+		auto value = readIndex(data + index * stride, accessor.componentType);
+
+		if (value > std::numeric_limits<GLushort>::max())
+			return "has indices that do not fit 16 bits";
+		else if (value >= vertexCount)
+			return "has indices past its vertices";
+	}
+
+	return "";
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void loadMesh(const GltfModel& model, const std::vector<GltfPrimitive>& primitives, Type type,
+	const glm::mat4& translation, const glm::mat4& rotation, const glm::mat4& scale, uint8_t room) {
+	for (auto& primitive : primitives) {
+		if (primitive.position < 0)
+			continue;
+
+		auto textureIndex = 0u;
+
+		if (primitive.material >= 0 && model.materialTextures[primitive.material] >= 0) {
+			auto image = model.textureSources[model.materialTextures[primitive.material]];
+			textureIndex = std::distance(imageNames.begin(), std::find(imageNames.begin(), imageNames.end(), model.imageNames[image]));
+		}
+
+		Mesh mesh{};
+
+		mesh.room = room;
+		mesh.transform = translation * rotation * scale;
+
+		auto& positionAccessor = model.accessors[primitive.position];
+
+		mesh.indexOffset = indices.size();
+
+		if (primitive.indices < 0) {
+			mesh.indexLength = static_cast<uint32_t>(positionAccessor.count);
+			indices.resize(mesh.indexOffset + mesh.indexLength);
+
+			for (auto index = 0u; index < mesh.indexLength; index++)
+				indices[mesh.indexOffset + index] = static_cast<GLushort>(index);
+		}
+
+		else {
+			uint64_t indexStride;
+			auto& indexAccessor = model.accessors[primitive.indices];
+			auto indexData = accessorData(model, primitive.indices, indexStride);
+
+			mesh.indexLength = static_cast<uint32_t>(indexAccessor.count);
+			indices.resize(mesh.indexOffset + mesh.indexLength);
+
+			for (auto index = 0u; index < mesh.indexLength; index++)
+				indices[mesh.indexOffset + index] = static_cast<GLushort>(readIndex(indexData + index * indexStride, indexAccessor.componentType));
+		}
+
+		uint64_t positionStride, normalStride = 0, textureStride = 0;
+		auto positionData = accessorData(model, primitive.position, positionStride);
+		auto normalData = primitive.normal >= 0 ? accessorData(model, primitive.normal, normalStride) : nullptr;
+		auto textureData = primitive.texture >= 0 ? accessorData(model, primitive.texture, textureStride) : nullptr;
+
+		auto positionSize = componentSize(positionAccessor.componentType);
+		auto normalType = normalData ? model.accessors.at(primitive.normal).componentType : 0;
+		auto normalSize = componentSize(normalType);
+		auto& textureAccessor = textureData ? model.accessors.at(primitive.texture) : positionAccessor;
+		auto textureSize = componentSize(textureAccessor.componentType);
+
+		mesh.vertexOffset = vertices.size();
+		mesh.vertexLength = static_cast<uint32_t>(positionAccessor.count);
+		mesh.textureIndex = textureIndex;
+
+		vertices.resize(mesh.vertexOffset + mesh.vertexLength);
+
+		auto min = glm::vec3{ std::numeric_limits<float_t>::max() }, max = glm::vec3{ -std::numeric_limits<float_t>::max() };
+
+		for (auto index = 0u; index < mesh.vertexLength; index++) {
+			auto& vertex = vertices[mesh.vertexOffset + index];
+			glm::vec3 position, normal{ 0.0f };
+			glm::vec2 texture{ 0.0f };
+
+			for (auto axis = 0; axis < 3; axis++)
+				position[axis] = readComponent(positionData + index * positionStride + axis * positionSize, positionAccessor.componentType, positionAccessor.normalized);
+
+			if (normalData)
+				for (auto axis = 0; axis < 3; axis++)
+					normal[axis] = readComponent(normalData + index * normalStride + axis * normalSize, normalType, true);
+
+			if (textureData)
+				for (auto axis = 0; axis < 2; axis++)
+					texture[axis] = readComponent(textureData + index * textureStride + axis * textureSize, textureAccessor.componentType, textureAccessor.normalized);
+
+			vertex.position = mesh.transform * glm::vec4{ position, 1.0f };
+			vertex.normal = normalData ? glm::normalize(glm::vec3{ mesh.transform * glm::vec4{ glm::normalize(normal), 0.0f } }) : normal;
+			vertex.texture = texture;
+
+			min = glm::min(min, vertex.position);
+			max = glm::max(max, vertex.position);
+		}
+
+		mesh.origin = glm::vec3{ mesh.transform * glm::vec4{ 0.0f, 0.0f, 0.0f, 1.0f } };
+		mesh.minBorders = min;
+		mesh.maxBorders = max;
+
+		if (type == Type::Mesh) {
+			meshCount++;
+			meshes.push_back(mesh);
+		}
+
+		else if (type == Type::Portal) {
+			Portal portal{};
+
+			portal.mesh = mesh;
+			portal.direction = glm::normalize(glm::vec3(mesh.transform * glm::vec4{ 0.0f, 0.0f, -1.0f, 0.0f }));
+
+			portalCount++;
+			portals.push_back(portal);
+		}
+	}
+}
+
+void closeModel(GltfModel& model) {
+	for (auto& buffer : model.buffers)
+		unmapFile(buffer);
+
+	model.buffers.clear();
+}
+
+bool readModel(GltfModel& model, const std::string name, std::string& messages) {
+	MappedFile file;
+
+	if (!mapFile(assetFolder + name + ".gltf", file)) {
+		messages += "GLTF Error: Cannot open " + name + ".gltf\n";
+		return false;
+	}
+
+	GltfHandler handler{ model };
+	auto text = reinterpret_cast<const char*>(file.data);
+	auto result = nlohmann::json::sax_parse(text, text + file.size, &handler);
+
+	unmapFile(file);
+
+	if (!result) {
+		messages += "GLTF Error: " + name + ".gltf " + handler.error + "\n";
+		return false;
+	}
+
+	for (auto& uri : model.bufferUris) {
+		model.buffers.emplace_back();
+
+		if (uri.empty() || !uri.compare(0, 5, "data:") || !mapFile(assetFolder + uri, model.buffers.back())) {
+			messages += "GLTF Error: Cannot map buffer " + (uri.size() > 64 ? uri.substr(0, 64) + "..." : uri) + " of " + name + ".gltf\n";
+			closeModel(model);
+			return false;
+		}
+	}
+
+	for (auto meshIndex = 0u; meshIndex < model.meshes.size(); meshIndex++)
+		for (auto primitiveIndex = 0u; primitiveIndex < model.meshes[meshIndex].size(); primitiveIndex++) {
+			auto& primitive = model.meshes[meshIndex][primitiveIndex];
+
+			if (primitive.position < 0)
+				continue;
+
+			auto problem = checkPrimitive(model, primitive);
+
+			if (!problem.empty()) {
+				messages += "GLTF Error: Primitive " + std::to_string(primitiveIndex) + " of mesh " + std::to_string(meshIndex) + " in " + name + ".gltf " + problem + "\n";
+				primitive.position = -1;
+			}
+		}
+
+	return true;
+}
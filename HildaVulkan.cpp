@@ -0,0 +1,1047 @@
+#include "Hilda.hpp"
+
+VkInstance vulkanInstance;
+VkPhysicalDevice vulkanPhysicalDevice;
+VkDevice vulkanDevice;
+uint32_t vulkanQueueFamily;
+VkQueue vulkanQueue;
+VkCommandPool vulkanUploadPool;
+VkSampler vulkanSampler;
+VkDescriptorSetLayout vulkanTextureLayout;
+VkDescriptorPool vulkanDescriptorPool;
+VkPipelineLayout vulkanPipelineLayout;
+VkPipeline vulkanScenePipeline;
+VkPipeline vulkanMaskPipeline;
+VkPipeline vulkanHiddenPipeline;
+VulkanBuffer vulkanVertices;
+VulkanBuffer vulkanIndices;
+VulkanBuffer vulkanHiddenVertices;
+std::vector<VulkanTexture> vulkanTextures;
+VulkanTarget vulkanTargets[2];
+std::array<VulkanFrame, vulkanFrameCount> vulkanFrames;
+
+//////////////////////////////////////////////////////////////////////////////
+
+void checkVulkan(VkResult result, const char* call) {
+	if (result != VK_SUCCESS)
+		throw std::runtime_error(std::string{ call } + " failed with VkResult " + std::to_string(result));
+}
+
+std::vector<const char*> extensionList(char* names) {
+	std::vector<const char*> extensions;
+
+	for (auto name = std::strtok(names, " "); name; name = std::strtok(nullptr, " "))
+		extensions.push_back(name);
+
+	return extensions;
+}
+
+uint32_t vulkanMemoryType(uint32_t typeBits, VkMemoryPropertyFlags properties) {
+	VkPhysicalDeviceMemoryProperties memory;
+	vkGetPhysicalDeviceMemoryProperties(vulkanPhysicalDevice, &memory);
+
+	for (auto index = 0u; index < memory.memoryTypeCount; index++)
+		if ((typeBits & (1u << index)) && (memory.memoryTypes[index].propertyFlags & properties) == properties)
+			return index;
+
+	throw std::runtime_error("No Vulkan memory type has the requested properties");
+}
+
+VulkanBuffer createVulkanBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties) {
+	VulkanBuffer buffer{};
+	buffer.size = size;
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	checkVulkan(vkCreateBuffer(vulkanDevice, &bufferInfo, nullptr, &buffer.buffer), "vkCreateBuffer");
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(vulkanDevice, buffer.buffer, &requirements);
+
+	VkMemoryAllocateInfo allocateInfo{};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocateInfo.allocationSize = requirements.size;
+	allocateInfo.memoryTypeIndex = vulkanMemoryType(requirements.memoryTypeBits, properties);
+
+	checkVulkan(vkAllocateMemory(vulkanDevice, &allocateInfo, nullptr, &buffer.memory), "vkAllocateMemory");
+	vkBindBufferMemory(vulkanDevice, buffer.buffer, buffer.memory, 0);
+
+	if (properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		checkVulkan(vkMapMemory(vulkanDevice, buffer.memory, 0, size, 0, &buffer.mapped), "vkMapMemory");
+
+	return buffer;
+}
+
+void destroyVulkanBuffer(VulkanBuffer& buffer) {
+	vkDestroyBuffer(vulkanDevice, buffer.buffer, nullptr);
+	vkFreeMemory(vulkanDevice, buffer.memory, nullptr);
+
+	buffer = {};
+}
+
+VkImageView createVulkanView(VkImage image, VkFormat format, VkImageAspectFlags aspect, uint32_t mipLevels) {
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = format;
+	viewInfo.subresourceRange = { aspect, 0, mipLevels, 0, 1 };
+
+	VkImageView view;
+	checkVulkan(vkCreateImageView(vulkanDevice, &viewInfo, nullptr, &view), "vkCreateImageView");
+
+	return view;
+}
+
+VulkanImage createVulkanImage(uint32_t imageWidth, uint32_t imageHeight, uint32_t mipLevels, VkFormat format, VkImageUsageFlags usage,
+	VkImageAspectFlags aspect) {
+	VulkanImage image{};
+
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = format;
+	imageInfo.extent = { imageWidth, imageHeight, 1 };
+	imageInfo.mipLevels = mipLevels;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = usage;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	checkVulkan(vkCreateImage(vulkanDevice, &imageInfo, nullptr, &image.image), "vkCreateImage");
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(vulkanDevice, image.image, &requirements);
+
+	VkMemoryAllocateInfo allocateInfo{};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocateInfo.allocationSize = requirements.size;
+	allocateInfo.memoryTypeIndex = vulkanMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	checkVulkan(vkAllocateMemory(vulkanDevice, &allocateInfo, nullptr, &image.memory), "vkAllocateMemory");
+	vkBindImageMemory(vulkanDevice, image.image, image.memory, 0);
+
+	image.view = createVulkanView(image.image, format, aspect, mipLevels);
+	return image;
+}
+
+void destroyVulkanImage(VulkanImage& image) {
+	vkDestroyImageView(vulkanDevice, image.view, nullptr);
+	vkDestroyImage(vulkanDevice, image.image, nullptr);
+	vkFreeMemory(vulkanDevice, image.memory, nullptr);
+
+	image = {};
+}
+
+void barrierImage(VkCommandBuffer commands, VkImage image, VkImageAspectFlags aspect, VkImageLayout oldLayout, VkImageLayout newLayout,
+	VkPipelineStageFlags sourceStage, VkAccessFlags sourceAccess, VkPipelineStageFlags targetStage, VkAccessFlags targetAccess,
+	uint32_t firstMip = 0, uint32_t mipCount = VK_REMAINING_MIP_LEVELS) {
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = sourceAccess;
+	barrier.dstAccessMask = targetAccess;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = { aspect, firstMip, mipCount, 0, 1 };
+
+	vkCmdPipelineBarrier(commands, sourceStage, targetStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+VkCommandBuffer beginVulkanUpload() {
+	VkCommandBufferAllocateInfo allocateInfo{};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocateInfo.commandPool = vulkanUploadPool;
+	allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocateInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commands;
+	checkVulkan(vkAllocateCommandBuffers(vulkanDevice, &allocateInfo, &commands), "vkAllocateCommandBuffers");
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(commands, &beginInfo);
+	return commands;
+}
+
+void endVulkanUpload(VkCommandBuffer commands) {
+	vkEndCommandBuffer(commands);
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commands;
+
+	checkVulkan(vkQueueSubmit(vulkanQueue, 1, &submitInfo, VK_NULL_HANDLE), "vkQueueSubmit");
+	vkQueueWaitIdle(vulkanQueue);
+
+	vkFreeCommandBuffers(vulkanDevice, vulkanUploadPool, 1, &commands);
+}
+
+VulkanBuffer uploadVulkanBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage) {
+	auto staging = createVulkanBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	std::memcpy(staging.mapped, data, size);
+
+	auto buffer = createVulkanBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	auto commands = beginVulkanUpload();
+
+	VkBufferCopy region{ 0, 0, size };
+	vkCmdCopyBuffer(commands, staging.buffer, buffer.buffer, 1, &region);
+
+	endVulkanUpload(commands);
+	destroyVulkanBuffer(staging);
+
+	return buffer;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void setupVulkan() {
+	// Lens-matched shading, multires, GPU culling and quantization are GL-only
+	if (lensMatched || multires || gpuCulling || quantized) {
+		std::cout << "Lens-matched, multires, GPU culling and quantized rendering are GL-only and ignored with Vulkan" << std::endl;
+		lensMatched = multires = gpuCulling = quantized = false;
+	}
+
+	if (!headless) {
+		glfwInit();
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+
+		createWindow();
+	}
+
+	static char instanceNames[4096], deviceNames[4096];
+	std::vector<const char*> instanceExtensions, deviceExtensions;
+
+	if (session) {
+		uint32_t instanceSize = sizeof(instanceNames), deviceSize = sizeof(deviceNames);
+
+		ovr_GetInstanceExtensionsVk(luid, instanceNames, &instanceSize);
+		ovr_GetDeviceExtensionsVk(luid, deviceNames, &deviceSize);
+
+		instanceExtensions = extensionList(instanceNames);
+		deviceExtensions = extensionList(deviceNames);
+	}
+
+	VkApplicationInfo applicationInfo{};
+	applicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+	applicationInfo.pApplicationName = "Hilda";
+	applicationInfo.apiVersion = VK_API_VERSION_1_3;
+
+	VkInstanceCreateInfo instanceInfo{};
+	instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+	instanceInfo.pApplicationInfo = &applicationInfo;
+	instanceInfo.enabledExtensionCount = static_cast<uint32_t>(instanceExtensions.size());
+	instanceInfo.ppEnabledExtensionNames = instanceExtensions.data();
+
+	checkVulkan(vkCreateInstance(&instanceInfo, nullptr, &vulkanInstance), "vkCreateInstance");
+
+	if (session)
+		ovr_GetSessionPhysicalDeviceVk(session, luid, vulkanInstance, &vulkanPhysicalDevice);
+
+	else {
+		uint32_t deviceCount = 1;
+		vkEnumeratePhysicalDevices(vulkanInstance, &deviceCount, &vulkanPhysicalDevice);
+
+		if (!deviceCount)
+			throw std::runtime_error("No Vulkan device is available");
+	}
+
+	uint32_t familyCount;
+	vkGetPhysicalDeviceQueueFamilyProperties(vulkanPhysicalDevice, &familyCount, nullptr);
+
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(vulkanPhysicalDevice, &familyCount, families.data());
+
+	vulkanQueueFamily = static_cast<uint32_t>(std::distance(families.begin(), std::find_if(families.begin(), families.end(),
+		[](const VkQueueFamilyProperties& family) { return family.queueFlags & VK_QUEUE_GRAPHICS_BIT; })));
+
+	auto priority = 1.0f;
+
+	VkDeviceQueueCreateInfo queueInfo{};
+	queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queueInfo.queueFamilyIndex = vulkanQueueFamily;
+	queueInfo.queueCount = 1;
+	queueInfo.pQueuePriorities = &priority;
+
+	VkPhysicalDeviceVulkan13Features features{};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+	features.dynamicRendering = VK_TRUE;
+
+	VkDeviceCreateInfo deviceInfo{};
+	deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	deviceInfo.pNext = &features;
+	deviceInfo.queueCreateInfoCount = 1;
+	deviceInfo.pQueueCreateInfos = &queueInfo;
+	deviceInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+	deviceInfo.ppEnabledExtensionNames = deviceExtensions.data();
+
+	checkVulkan(vkCreateDevice(vulkanPhysicalDevice, &deviceInfo, nullptr, &vulkanDevice), "vkCreateDevice");
+	vkGetDeviceQueue(vulkanDevice, vulkanQueueFamily, 0, &vulkanQueue);
+
+	if (session)
+		ovr_SetSynchronizationQueueVk(session, vulkanQueue);
+
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolInfo.queueFamilyIndex = vulkanQueueFamily;
+
+	checkVulkan(vkCreateCommandPool(vulkanDevice, &poolInfo, nullptr, &vulkanUploadPool), "vkCreateCommandPool");
+}
+
+void uploadVulkanTexture(Image& image, const uint8_t* pixels) {
+	const uint8_t black[4]{ 0, 0, 0, 255 };
+	auto textureWidth = pixels ? static_cast<uint32_t>(image.width) : 1u, textureHeight = pixels ? static_cast<uint32_t>(image.height) : 1u;
+	auto mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(textureWidth, textureHeight)))) + 1;
+	auto size = VkDeviceSize{ textureWidth } * textureHeight * 4;
+
+	auto staging = createVulkanBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	std::memcpy(staging.mapped, pixels ? pixels : black, size);
+
+	VulkanTexture texture{};
+	texture.image = createVulkanImage(textureWidth, textureHeight, mipLevels, VK_FORMAT_R8G8B8A8_SRGB,
+		VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+
+	auto commands = beginVulkanUpload();
+	auto textureImage = texture.image.image;
+
+	barrierImage(commands, textureImage, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+	VkBufferImageCopy region{};
+	region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+	region.imageExtent = { textureWidth, textureHeight, 1 };
+
+	vkCmdCopyBufferToImage(commands, staging.buffer, textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+	for (auto level = 1u; level < mipLevels; level++) {
+		barrierImage(commands, textureImage, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, level - 1, 1);
+
+		VkImageBlit blit{};
+		blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1 };
+		blit.srcOffsets[1] = { std::max(1, int32_t(textureWidth >> (level - 1))), std::max(1, int32_t(textureHeight >> (level - 1))), 1 };
+		blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+		blit.dstOffsets[1] = { std::max(1, int32_t(textureWidth >> level)), std::max(1, int32_t(textureHeight >> level)), 1 };
+
+		vkCmdBlitImage(commands, textureImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+			VK_FILTER_LINEAR);
+
+		barrierImage(commands, textureImage, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, level - 1, 1);
+	}
+
+	barrierImage(commands, textureImage, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, mipLevels - 1, 1);
+
+	endVulkanUpload(commands);
+	destroyVulkanBuffer(staging);
+
+	image.texture = static_cast<uint32_t>(vulkanTextures.size());
+	vulkanTextures.push_back(texture);
+}
+
+void createVulkanDescriptors() {
+	VkSamplerCreateInfo samplerInfo{};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	checkVulkan(vkCreateSampler(vulkanDevice, &samplerInfo, nullptr, &vulkanSampler), "vkCreateSampler");
+
+	VkDescriptorSetLayoutBinding binding{};
+	binding.binding = 0;
+	binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	binding.descriptorCount = 1;
+	binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 1;
+	layoutInfo.pBindings = &binding;
+
+	checkVulkan(vkCreateDescriptorSetLayout(vulkanDevice, &layoutInfo, nullptr, &vulkanTextureLayout), "vkCreateDescriptorSetLayout");
+
+	auto textureCount = std::max(1u, static_cast<uint32_t>(vulkanTextures.size()));
+	VkDescriptorPoolSize poolSize{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textureCount };
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = textureCount;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+
+	checkVulkan(vkCreateDescriptorPool(vulkanDevice, &poolInfo, nullptr, &vulkanDescriptorPool), "vkCreateDescriptorPool");
+
+	for (auto& texture : vulkanTextures) {
+		VkDescriptorSetAllocateInfo allocateInfo{};
+		allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocateInfo.descriptorPool = vulkanDescriptorPool;
+		allocateInfo.descriptorSetCount = 1;
+		allocateInfo.pSetLayouts = &vulkanTextureLayout;
+
+		checkVulkan(vkAllocateDescriptorSets(vulkanDevice, &allocateInfo, &texture.descriptorSet), "vkAllocateDescriptorSets");
+
+		VkDescriptorImageInfo imageInfo{ vulkanSampler, texture.image.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+		VkWriteDescriptorSet write{};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = texture.descriptorSet;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write.pImageInfo = &imageInfo;
+
+		vkUpdateDescriptorSets(vulkanDevice, 1, &write, 0, nullptr);
+	}
+
+	VkPushConstantRange pushRange{ VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(OVR::Matrix4f) };
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &vulkanTextureLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushRange;
+
+	checkVulkan(vkCreatePipelineLayout(vulkanDevice, &pipelineLayoutInfo, nullptr, &vulkanPipelineLayout), "vkCreatePipelineLayout");
+}
+
+VkShaderModule createVulkanShader(const std::string path) {
+	auto binary = readShaderBinary(path);
+
+	if (binary.empty())
+		throw std::runtime_error("Missing SPIR-V module " + shaderFolder + path + ", it is compiled from the GLSL sources at build time");
+
+	VkShaderModuleCreateInfo moduleInfo{};
+	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleInfo.codeSize = binary.size();
+	moduleInfo.pCode = reinterpret_cast<const uint32_t*>(binary.data());
+
+	VkShaderModule module;
+	checkVulkan(vkCreateShaderModule(vulkanDevice, &moduleInfo, nullptr, &module), "vkCreateShaderModule");
+
+	return module;
+}
+
+VkPipeline createVulkanPipeline(const std::string vertexPath, const std::string fragmentPath, uint32_t stride,
+	const std::vector<VkVertexInputAttributeDescription>& attributes, VkCullModeFlags cullMode) {
+	std::vector<VkPipelineShaderStageCreateInfo> stages(fragmentPath.empty() ? 1 : 2, VkPipelineShaderStageCreateInfo{});
+
+	for (auto index = 0u; index < stages.size(); index++) {
+		stages[index].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		stages[index].stage = index ? VK_SHADER_STAGE_FRAGMENT_BIT : VK_SHADER_STAGE_VERTEX_BIT;
+		stages[index].module = createVulkanShader(index ? fragmentPath : vertexPath);
+		stages[index].pName = "main";
+	}
+
+	VkVertexInputBindingDescription binding{ 0, stride, VK_VERTEX_INPUT_RATE_VERTEX };
+
+	VkPipelineVertexInputStateCreateInfo vertexInput{};
+	vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInput.vertexBindingDescriptionCount = 1;
+	vertexInput.pVertexBindingDescriptions = &binding;
+	vertexInput.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributes.size());
+	vertexInput.pVertexAttributeDescriptions = attributes.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+	VkPipelineViewportStateCreateInfo viewportState{};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.viewportCount = 1;
+	viewportState.scissorCount = 1;
+
+	VkPipelineRasterizationStateCreateInfo rasterization{};
+	rasterization.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterization.cullMode = cullMode;
+	rasterization.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	rasterization.lineWidth = 1.0f;
+
+	VkPipelineMultisampleStateCreateInfo multisample{};
+	multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	VkStencilOpState stencil{ VK_STENCIL_OP_KEEP, VK_STENCIL_OP_KEEP, VK_STENCIL_OP_KEEP, VK_COMPARE_OP_ALWAYS, 0xFF, 0xFF, 0 };
+
+	VkPipelineDepthStencilStateCreateInfo depthStencil{};
+	depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencil.depthTestEnable = VK_TRUE;
+	depthStencil.depthWriteEnable = VK_TRUE;
+	depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+	depthStencil.stencilTestEnable = VK_TRUE;
+	depthStencil.front = stencil;
+	depthStencil.back = stencil;
+
+	VkPipelineColorBlendAttachmentState blendAttachment{};
+	blendAttachment.colorWriteMask = fragmentPath.empty() ? 0 :
+		VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+	VkPipelineColorBlendStateCreateInfo colorBlend{};
+	colorBlend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlend.attachmentCount = 1;
+	colorBlend.pAttachments = &blendAttachment;
+
+	VkDynamicState dynamicStates[]{ VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR, VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK,
+		VK_DYNAMIC_STATE_STENCIL_WRITE_MASK, VK_DYNAMIC_STATE_STENCIL_REFERENCE, VK_DYNAMIC_STATE_STENCIL_OP };
+
+	VkPipelineDynamicStateCreateInfo dynamicState{};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = static_cast<uint32_t>(std::size(dynamicStates));
+	dynamicState.pDynamicStates = dynamicStates;
+
+	VkFormat colorFormat = VK_FORMAT_R8G8B8A8_SRGB;
+
+	VkPipelineRenderingCreateInfo renderingInfo{};
+	renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+	renderingInfo.colorAttachmentCount = 1;
+	renderingInfo.pColorAttachmentFormats = &colorFormat;
+	renderingInfo.depthAttachmentFormat = VK_FORMAT_D32_SFLOAT_S8_UINT;
+	renderingInfo.stencilAttachmentFormat = VK_FORMAT_D32_SFLOAT_S8_UINT;
+
+	VkGraphicsPipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.pNext = &renderingInfo;
+	pipelineInfo.stageCount = static_cast<uint32_t>(stages.size());
+	pipelineInfo.pStages = stages.data();
+	pipelineInfo.pVertexInputState = &vertexInput;
+	pipelineInfo.pInputAssemblyState = &inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &rasterization;
+	pipelineInfo.pMultisampleState = &multisample;
+	pipelineInfo.pDepthStencilState = &depthStencil;
+	pipelineInfo.pColorBlendState = &colorBlend;
+	pipelineInfo.pDynamicState = &dynamicState;
+	pipelineInfo.layout = vulkanPipelineLayout;
+
+	VkPipeline pipeline;
+	checkVulkan(vkCreateGraphicsPipelines(vulkanDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline), "vkCreateGraphicsPipelines");
+
+	for (auto& stage : stages)
+		vkDestroyShaderModule(vulkanDevice, stage.module, nullptr);
+
+	return pipeline;
+}
+
+void createVulkanTargets() {
+	for (int eye = 0; eye < 2; eye++) {
+		auto& framebuffer = framebuffers[eye];
+		auto& target = vulkanTargets[eye];
+
+		if (session) {
+			ovrTextureSwapChainDesc desc = {};
+			desc.Type = ovrTexture_2D;
+			desc.ArraySize = 1;
+			desc.Width = framebuffer.width;
+			desc.Height = framebuffer.height;
+			desc.MipLevels = 1;
+			desc.SampleCount = 1;
+			desc.StaticImage = ovrFalse;
+
+			int length;
+
+			desc.Format = OVR_FORMAT_R8G8B8A8_UNORM_SRGB;
+			desc.BindFlags = ovrTextureBind_DX_RenderTarget;
+
+			ovr_CreateTextureSwapChainVk(session, vulkanDevice, &desc, &framebuffer.textureSwapchain);
+			ovr_GetTextureSwapChainLength(session, framebuffer.textureSwapchain, &length);
+
+			for (int i = 0; i < length; i++) {
+				VkImage image;
+				ovr_GetTextureSwapChainBufferVk(session, framebuffer.textureSwapchain, i, &image);
+
+				target.colorImages.push_back(image);
+				target.colorViews.push_back(createVulkanView(image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, 1));
+			}
+
+			desc.Format = OVR_FORMAT_D32_FLOAT_S8X24_UINT;
+			desc.BindFlags = ovrTextureBind_DX_DepthStencil;
+
+			ovr_CreateTextureSwapChainVk(session, vulkanDevice, &desc, &framebuffer.depthStencilSwapchain);
+			ovr_GetTextureSwapChainLength(session, framebuffer.depthStencilSwapchain, &length);
+
+			for (int i = 0; i < length; i++) {
+				VkImage image;
+				ovr_GetTextureSwapChainBufferVk(session, framebuffer.depthStencilSwapchain, i, &image);
+
+				target.depthImages.push_back(image);
+				target.depthViews.push_back(createVulkanView(image, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT, 1));
+			}
+		}
+
+		else {
+			target.color = createVulkanImage(framebuffer.width, framebuffer.height, 1, VK_FORMAT_R8G8B8A8_SRGB,
+				VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT);
+			target.depth = createVulkanImage(framebuffer.width, framebuffer.height, 1, VK_FORMAT_D32_SFLOAT_S8_UINT,
+				VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT);
+
+			target.colorImages.push_back(target.color.image);
+			target.colorViews.push_back(target.color.view);
+			target.depthImages.push_back(target.depth.image);
+			target.depthViews.push_back(target.depth.view);
+
+			if (captureFrame >= 0)
+				target.capture = createVulkanBuffer(VkDeviceSize{ framebuffer.width } * framebuffer.height * 4, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		}
+	}
+}
+
+void createVulkanFrames() {
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolInfo.queueFamilyIndex = vulkanQueueFamily;
+
+	VkCommandBufferAllocateInfo allocateInfo{};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	for (auto& frame : vulkanFrames) {
+		checkVulkan(vkCreateFence(vulkanDevice, &fenceInfo, nullptr, &frame.fence), "vkCreateFence");
+		checkVulkan(vkCreateCommandPool(vulkanDevice, &poolInfo, nullptr, &frame.pool), "vkCreateCommandPool");
+
+		allocateInfo.commandPool = frame.pool;
+		allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocateInfo.commandBufferCount = 1;
+
+		checkVulkan(vkAllocateCommandBuffers(vulkanDevice, &allocateInfo, &frame.commands), "vkAllocateCommandBuffers");
+
+		frame.threadPools.resize(jobQueues.size());
+
+		for (auto& threadPool : frame.threadPools) {
+			checkVulkan(vkCreateCommandPool(vulkanDevice, &poolInfo, nullptr, &threadPool.pool), "vkCreateCommandPool");
+
+			allocateInfo.commandPool = threadPool.pool;
+			allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocateInfo.commandBufferCount = static_cast<uint32_t>(threadPool.buffers.size());
+
+			checkVulkan(vkAllocateCommandBuffers(vulkanDevice, &allocateInfo, threadPool.buffers.data()), "vkAllocateCommandBuffers");
+			threadPool.used = 0;
+		}
+	}
+}
+
+void setupVulkanScene() {
+	createVulkanDescriptors();
+	createVulkanTargets();
+	createVulkanFrames();
+
+	vulkanVertices = uploadVulkanBuffer(vertices.data(), sizeof(Vertex) * vertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	vulkanIndices = uploadVulkanBuffer(indices.data(), sizeof(GLushort) * indices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+
+	auto hiddenVertices = hiddenAreaVertices();
+	vulkanHiddenVertices = uploadVulkanBuffer(hiddenVertices.data(), sizeof(glm::vec2) * hiddenVertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+
+	std::vector<VkVertexInputAttributeDescription> sceneAttributes{
+		{ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, position) },
+		{ 1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, normal) },
+		{ 2, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, texture) }
+	};
+
+	std::vector<VkVertexInputAttributeDescription> positionAttributes{ sceneAttributes.front() };
+	std::vector<VkVertexInputAttributeDescription> hiddenAttributes{ { 0, 0, VK_FORMAT_R32G32_SFLOAT, 0 } };
+
+	vulkanScenePipeline = createVulkanPipeline("vertex.vk.spv", lighting ? "fragment.lighting.vk.spv" : "fragment.vk.spv", sizeof(Vertex),
+		sceneAttributes, VK_CULL_MODE_BACK_BIT);
+	vulkanMaskPipeline = createVulkanPipeline("vertex.mask.vk.spv", "", sizeof(Vertex), positionAttributes, VK_CULL_MODE_BACK_BIT);
+	vulkanHiddenPipeline = createVulkanPipeline("hidden.vk.spv", "", sizeof(glm::vec2), hiddenAttributes, VK_CULL_MODE_NONE);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void bindVulkanScene(VkCommandBuffer commands, VkPipeline pipeline) {
+	VkDeviceSize offset = 0;
+
+	vkCmdBindPipeline(commands, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	vkCmdBindVertexBuffers(commands, 0, 1, &vulkanVertices.buffer, &offset);
+}
+
+void recordVulkanNode(VulkanFrame& frame, int eye, uint8_t nodeIndex, const OVR::Matrix4f& transform) {
+	auto& framebuffer = framebuffers[eye];
+	auto& threadPool = frame.threadPools.at(jobQueueIndex);
+	auto commands = threadPool.buffers.at(threadPool.used++);
+
+	VkFormat colorFormat = VK_FORMAT_R8G8B8A8_SRGB;
+
+	VkCommandBufferInheritanceRenderingInfo renderingInfo{};
+	renderingInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+	renderingInfo.colorAttachmentCount = 1;
+	renderingInfo.pColorAttachmentFormats = &colorFormat;
+	renderingInfo.depthAttachmentFormat = VK_FORMAT_D32_SFLOAT_S8_UINT;
+	renderingInfo.stencilAttachmentFormat = VK_FORMAT_D32_SFLOAT_S8_UINT;
+	renderingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	VkCommandBufferInheritanceInfo inheritance{};
+	inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritance.pNext = &renderingInfo;
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = &inheritance;
+
+	vkBeginCommandBuffer(commands, &beginInfo);
+
+	// The negative height puts GL's bottom-left origin at the bottom
+	auto viewportWidth = float_t(framebuffer.viewportWidth), viewportHeight = float_t(framebuffer.viewportHeight);
+	VkViewport viewport{ 0.0f, viewportHeight, viewportWidth, -viewportHeight, 0.0f, 1.0f };
+	VkRect2D area{ { 0, 0 }, { framebuffer.viewportWidth, framebuffer.viewportHeight } };
+
+	vkCmdSetViewport(commands, 0, 1, &viewport);
+	vkCmdSetScissor(commands, 0, 1, &area);
+	vkCmdSetStencilOp(commands, VK_STENCIL_FACE_FRONT_AND_BACK, VK_STENCIL_OP_KEEP, VK_STENCIL_OP_KEEP, VK_STENCIL_OP_KEEP, VK_COMPARE_OP_ALWAYS);
+	vkCmdSetStencilCompareMask(commands, VK_STENCIL_FACE_FRONT_AND_BACK, 0xFF);
+	vkCmdSetStencilWriteMask(commands, VK_STENCIL_FACE_FRONT_AND_BACK, 0xFF);
+	vkCmdSetStencilReference(commands, VK_STENCIL_FACE_FRONT_AND_BACK, 0);
+
+	bindVulkanScene(commands, vulkanScenePipeline);
+	vkCmdBindIndexBuffer(commands, vulkanIndices.buffer, 0, VK_INDEX_TYPE_UINT16);
+	vkCmdPushConstants(commands, vulkanPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(transform), &transform);
+
+	auto& node = currentPacket->nodes[eye].at(nodeIndex);
+	auto nodeCommands = currentPacket->commandLists[eye].data() + node.commandOffset;
+	auto passOperation = VK_STENCIL_OP_KEEP;
+	auto compareOperation = VK_COMPARE_OP_ALWAYS;
+
+	for (auto index = 0u; index < node.commandCount; index++) {
+		auto& command = nodeCommands[index];
+		auto& arguments = command.arguments;
+
+		switch (command.type) {
+		case Command::ClearDepth: {
+			VkClearAttachment clear{};
+			clear.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+			clear.clearValue.depthStencil = { 1.0f, 0 };
+
+			VkClearRect rect{ area, 0, 1 };
+			vkCmdClearAttachments(commands, 1, &clear, 1, &rect);
+			break;
+		}
+		case Command::HiddenArea: {
+			VkDeviceSize offset = 0;
+
+			vkCmdBindPipeline(commands, VK_PIPELINE_BIND_POINT_GRAPHICS, vulkanHiddenPipeline);
+			vkCmdBindVertexBuffers(commands, 0, 1, &vulkanHiddenVertices.buffer, &offset);
+			vkCmdDraw(commands, hiddenAreas[eye].count, 1, hiddenAreas[eye].first, 0);
+
+			bindVulkanScene(commands, vulkanScenePipeline);
+			break;
+		}
+		case Command::Stencil:
+			compareOperation = arguments[0] ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_ALWAYS;
+
+			vkCmdSetStencilOp(commands, VK_STENCIL_FACE_FRONT_AND_BACK, VK_STENCIL_OP_KEEP, passOperation, VK_STENCIL_OP_KEEP, compareOperation);
+			vkCmdSetStencilReference(commands, VK_STENCIL_FACE_FRONT_AND_BACK, arguments[1]);
+			vkCmdSetStencilCompareMask(commands, VK_STENCIL_FACE_FRONT_AND_BACK, arguments[2]);
+			vkCmdSetStencilWriteMask(commands, VK_STENCIL_FACE_FRONT_AND_BACK, arguments[3]);
+			break;
+		case Command::StencilReplace:
+			passOperation = arguments[0] ? VK_STENCIL_OP_REPLACE : VK_STENCIL_OP_KEEP;
+
+			vkCmdSetStencilOp(commands, VK_STENCIL_FACE_FRONT_AND_BACK, VK_STENCIL_OP_KEEP, passOperation, VK_STENCIL_OP_KEEP, compareOperation);
+			break;
+		case Command::DrawMesh:
+			vkCmdBindDescriptorSets(commands, VK_PIPELINE_BIND_POINT_GRAPHICS, vulkanPipelineLayout, 0, 1,
+				&vulkanTextures[textures[meshStreams.textureIndices[arguments[0]]].texture].descriptorSet, 0, nullptr);
+			vkCmdDrawIndexed(commands, meshStreams.indexLengths[arguments[0]], 1, meshStreams.indexOffsets[arguments[0]], meshStreams.vertexOffsets[arguments[0]], 0);
+			break;
+		case Command::BeginMask:
+			vkCmdBindPipeline(commands, VK_PIPELINE_BIND_POINT_GRAPHICS, vulkanMaskPipeline);
+			break;
+		case Command::DrawMask:
+			vkCmdDrawIndexed(commands, portalStreams.indexLengths[arguments[0]], 1, portalStreams.indexOffsets[arguments[0]], portalStreams.vertexOffsets[arguments[0]], 0);
+			break;
+		case Command::EndMask:
+			vkCmdBindPipeline(commands, VK_PIPELINE_BIND_POINT_GRAPHICS, vulkanScenePipeline);
+			break;
+		case Command::DrawCulled:
+		case Command::BeginConditional:
+		case Command::EndConditional:
+			break;
+		}
+	}
+
+	checkVulkan(vkEndCommandBuffer(commands), "vkEndCommandBuffer");
+	frame.nodeCommands[eye][nodeIndex] = commands;
+}
+
+void renderVulkanEye(VulkanFrame& frame, int eye) {
+	auto& framebuffer = framebuffers[eye];
+	auto& target = vulkanTargets[eye];
+	auto commands = frame.commands;
+	int colorIndex = 0, depthIndex = 0;
+
+	if (session) {
+		ovr_GetTextureSwapChainCurrentIndex(session, framebuffer.textureSwapchain, &colorIndex);
+		ovr_GetTextureSwapChainCurrentIndex(session, framebuffer.depthStencilSwapchain, &depthIndex);
+	}
+
+	auto colorImage = target.colorImages.at(colorIndex), depthImage = target.depthImages.at(depthIndex);
+	auto depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+	auto depthStages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+	barrierImage(commands, colorImage, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+	barrierImage(commands, depthImage, depthAspect, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		depthStages, 0, depthStages, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+	VkRenderingAttachmentInfo colorAttachment{};
+	colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+	colorAttachment.imageView = target.colorViews.at(colorIndex);
+	colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	colorAttachment.clearValue.color = { { 0.4f, 0.8f, 1.0f, 1.0f } };
+
+	VkRenderingAttachmentInfo depthAttachment{};
+	depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+	depthAttachment.imageView = target.depthViews.at(depthIndex);
+	depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	depthAttachment.clearValue.depthStencil = { 1.0f, 0 };
+
+	auto stencilAttachment = depthAttachment;
+	stencilAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+	VkRenderingInfo renderingInfo{};
+	renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+	renderingInfo.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+	renderingInfo.renderArea = { { 0, 0 }, { framebuffer.viewportWidth, framebuffer.viewportHeight } };
+	renderingInfo.layerCount = 1;
+	renderingInfo.colorAttachmentCount = 1;
+	renderingInfo.pColorAttachments = &colorAttachment;
+	renderingInfo.pDepthAttachment = &depthAttachment;
+	renderingInfo.pStencilAttachment = &stencilAttachment;
+
+	vkCmdBeginRendering(commands, &renderingInfo);
+	vkCmdExecuteCommands(commands, static_cast<uint32_t>(currentPacket->nodes[eye].size()), frame.nodeCommands[eye].data());
+	vkCmdEndRendering(commands);
+
+	if (renderFrameIndex == captureFrame && target.capture.buffer) {
+		barrierImage(commands, colorImage, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+
+		VkBufferImageCopy region{};
+		region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		region.imageExtent = { framebuffer.viewportWidth, framebuffer.viewportHeight, 1 };
+
+		vkCmdCopyImageToBuffer(commands, colorImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, target.capture.buffer, 1, &region);
+	}
+}
+
+void captureVulkanEye(int eye) {
+	auto& framebuffer = framebuffers[eye];
+	auto& pixels = capturedPixels[eye];
+	auto source = static_cast<const uint8_t*>(vulkanTargets[eye].capture.mapped);
+
+	pixels.resize(framebuffer.viewportWidth * framebuffer.viewportHeight * 3);
+
+	// Vulkan rows start at the top, captures are kept bottom-up like GL reads them
+	for (auto row = 0u; row < framebuffer.viewportHeight; row++)
+		for (auto column = 0u; column < framebuffer.viewportWidth; column++)
+			for (auto channel = 0u; channel < 3; channel++)
+				pixels[((framebuffer.viewportHeight - 1 - row) * framebuffer.viewportWidth + column) * 3 + channel] =
+					source[(row * framebuffer.viewportWidth + column) * 4 + channel];
+}
+
+void renderVulkanFrame(const RenderPacket& packet) {
+	currentPacket = &packet;
+	renderFrameIndex = packet.frameIndex;
+	profiledFrame = packet.frameIndex;
+
+	auto frameProfile = beginProfile("render", -1, -1);
+	auto& frame = vulkanFrames.at(renderFrameIndex % vulkanFrameCount);
+
+	vkWaitForFences(vulkanDevice, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+
+	if (!packet.visible) {
+		markFrameBegun(renderFrameIndex);
+		endProfile(frameProfile);
+
+		return;
+	}
+
+	if (session)
+		ovr_BeginFrame(session, renderFrameIndex);
+
+	markFrameBegun(renderFrameIndex);
+
+	vkResetCommandPool(vulkanDevice, frame.pool, 0);
+
+	for (auto& threadPool : frame.threadPools) {
+		vkResetCommandPool(vulkanDevice, threadPool.pool, 0);
+		threadPool.used = 0;
+	}
+
+	OVR::Matrix4f transforms[2][nodeCapacity];
+
+	for (int eye = 0; eye < 2; eye++) {
+		auto& eyeNodes = packet.nodes[eye];
+
+		OVR::Matrix4f proj = ovrMatrix4f_Projection(hmdDesc.DefaultEyeFov[eye], 0.01f, 1000.0f, ovrProjection_None);
+		timewarpProjectionDesc = ovrTimewarpProjectionDesc_FromProjection(proj, ovrProjection_None);
+
+		for (uint8_t index = 0; index < eyeNodes.size(); index++) {
+			auto& node = eyeNodes.at(index);
+
+			OVR::Vector3f nodeEyePos(node.translation.x, node.translation.y, node.translation.z);
+			OVR::Matrix4f view = OVR::Matrix4f::LookAtRH(nodeEyePos, nodeEyePos + packet.forwardVectors[eye], packet.upVectors[eye]);
+
+			transforms[eye][index] = proj * view;
+			transforms[eye][index].Transpose();
+		}
+	}
+
+	auto recordProfile = beginProfile("record", -1, -1);
+	auto firstEyeCount = packet.nodes[0].size();
+
+	parallelFor(firstEyeCount + packet.nodes[1].size(), 1, [&](uint32_t first, uint32_t last) {
+		profiledFrame = packet.frameIndex;
+
+		for (auto index = first; index < last; index++) {
+			auto eye = index < firstEyeCount ? 0 : 1;
+			auto nodeIndex = static_cast<uint8_t>(eye ? index - firstEyeCount : index);
+
+			recordVulkanNode(frame, eye, nodeIndex, transforms[eye][nodeIndex]);
+		}
+	});
+
+	endProfile(recordProfile);
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(frame.commands, &beginInfo);
+
+	for (int eye = 0; eye < 2; eye++)
+		renderVulkanEye(frame, eye);
+
+	checkVulkan(vkEndCommandBuffer(frame.commands), "vkEndCommandBuffer");
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &frame.commands;
+
+	vkResetFences(vulkanDevice, 1, &frame.fence);
+	checkVulkan(vkQueueSubmit(vulkanQueue, 1, &submitInfo, frame.fence), "vkQueueSubmit");
+
+	if (session) {
+		for (int eye = 0; eye < 2; eye++) {
+			ovr_CommitTextureSwapChain(session, framebuffers[eye].textureSwapchain);
+			ovr_CommitTextureSwapChain(session, framebuffers[eye].depthStencilSwapchain);
+		}
+
+		submitFrame(packet.record);
+	}
+
+	if (renderFrameIndex == captureFrame && vulkanTargets[0].capture.buffer) {
+		vkWaitForFences(vulkanDevice, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+
+		for (int eye = 0; eye < 2; eye++)
+			captureVulkanEye(eye);
+	}
+
+	endProfile(frameProfile);
+}
+
+void cleanVulkan() {
+	vkDeviceWaitIdle(vulkanDevice);
+
+	for (auto& frame : vulkanFrames) {
+		for (auto& threadPool : frame.threadPools)
+			vkDestroyCommandPool(vulkanDevice, threadPool.pool, nullptr);
+
+		vkDestroyCommandPool(vulkanDevice, frame.pool, nullptr);
+		vkDestroyFence(vulkanDevice, frame.fence, nullptr);
+	}
+
+	for (int eye = 0; eye < 2; eye++) {
+		auto& target = vulkanTargets[eye];
+
+		if (session) {
+			for (auto view : target.colorViews)
+				vkDestroyImageView(vulkanDevice, view, nullptr);
+			for (auto view : target.depthViews)
+				vkDestroyImageView(vulkanDevice, view, nullptr);
+
+			ovr_DestroyTextureSwapChain(session, framebuffers[eye].textureSwapchain);
+			ovr_DestroyTextureSwapChain(session, framebuffers[eye].depthStencilSwapchain);
+		}
+
+		destroyVulkanImage(target.color);
+		destroyVulkanImage(target.depth);
+		destroyVulkanBuffer(target.capture);
+	}
+
+	for (auto& texture : vulkanTextures)
+		destroyVulkanImage(texture.image);
+
+	destroyVulkanBuffer(vulkanVertices);
+	destroyVulkanBuffer(vulkanIndices);
+	destroyVulkanBuffer(vulkanHiddenVertices);
+
+	vkDestroyPipeline(vulkanDevice, vulkanScenePipeline, nullptr);
+	vkDestroyPipeline(vulkanDevice, vulkanMaskPipeline, nullptr);
+	vkDestroyPipeline(vulkanDevice, vulkanHiddenPipeline, nullptr);
+	vkDestroyPipelineLayout(vulkanDevice, vulkanPipelineLayout, nullptr);
+	vkDestroyDescriptorPool(vulkanDevice, vulkanDescriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(vulkanDevice, vulkanTextureLayout, nullptr);
+	vkDestroySampler(vulkanDevice, vulkanSampler, nullptr);
+	vkDestroyCommandPool(vulkanDevice, vulkanUploadPool, nullptr);
+
+	vkDestroyDevice(vulkanDevice, nullptr);
+	vkDestroyInstance(vulkanInstance, nullptr);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void VulkanRenderer::setup() {
+	setupVulkan();
+}
+
+void VulkanRenderer::uploadTexture(Image& image, const uint8_t* pixels) {
+	uploadVulkanTexture(image, pixels);
+}
+
+void VulkanRenderer::setupScene() {
+	setupVulkanScene();
+}
+
+void VulkanRenderer::attachThread() {
+}
+
+void VulkanRenderer::detachThread() {
+}
+
+void VulkanRenderer::renderFrame(const RenderPacket& packet) {
+	renderVulkanFrame(packet);
+}
+
+void VulkanRenderer::clean() {
+	cleanVulkan();
+}
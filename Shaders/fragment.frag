@@ -1,5 +1,12 @@
 #version 460 core
 
+#ifdef MASK_ONLY
+layout(early_fragment_tests) in;
+
+void main()
+{
+}
+#else
 layout(binding = 0) uniform sampler2D textureSampler;
 
 layout(location = 0) in vec3 inputPosition;
@@ -10,16 +17,19 @@ layout(location = 0) out vec4 outputColor;
 
 void main()
 {
+	vec3 ambientLight = vec3(0.8f, 0.8f, 0.8f);
+
+#ifdef LIGHTING
 	vec3 lightPosition = vec3(-8.0f, 8.0f, 8.0f);
 	vec3 lightDirection = normalize(lightPosition - inputPosition);
-	float intensity = max(dot(inputNormal, lightDirection), 0.0f);
-	
-	vec3 lightColor = vec3(0.0f, 0.0f, 0.0f);
-	//vec3 lightColor = vec3(1.0f, 1.0f, 1.0f);
+	float intensity = max(dot(normalize(inputNormal), lightDirection), 0.0f);
+
+	vec3 lightColor = vec3(1.0f, 1.0f, 1.0f);
 	vec3 pointLight = intensity * lightColor;
-	vec3 ambientLight = vec3(0.8f, 0.8f, 0.8f);
-	
-	//outputColor = vec4(0.0f, 0.0f, 1.0f, 1.0f);
-	//outputColor = vec4(pointLight + ambientLight, 1.0f) * vec4((inputNormal + 1) / 2.0f, 1.0f);
+
 	outputColor = vec4(pointLight + ambientLight, 1.0f) * texture(textureSampler, inputTexture);
+#else
+	outputColor = vec4(ambientLight, 1.0f) * texture(textureSampler, inputTexture);
+#endif
 }
+#endif
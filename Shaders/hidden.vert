@@ -0,0 +1,16 @@
+#version 460 core
+
+#ifndef VULKAN
+layout(location = 0) uniform mat4 warp;
+#endif
+
+layout(location = 0) in vec2 inputPosition;
+
+void main()
+{
+#ifdef VULKAN
+	gl_Position = vec4(inputPosition * 2.0f - 1.0f, 0.0f, 1.0f);
+#else
+	gl_Position = warp * vec4(inputPosition * 2.0f - 1.0f, -1.0f, 1.0f);
+#endif
+}
@@ -0,0 +1,9 @@
+vec4 distort(vec4 p)
+{
+	vec2 v = p.xy / p.w;
+
+	v = v * (1.0f + lensWarp) / (1.0f + lensWarp * (abs(v.x) + abs(v.y)));
+	p.xy = v.xy * p.w;
+
+	return p;
+}
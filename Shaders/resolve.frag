@@ -0,0 +1,18 @@
+#version 460 core
+
+layout(binding = 0) uniform sampler2D colorSampler;
+layout(binding = 1) uniform sampler2D depthSampler;
+
+layout(location = 0) uniform vec2 lensExtent;
+
+layout(location = 0) in vec2 inputPosition;
+
+layout(location = 0) out vec4 outputColor;
+
+void main()
+{
+	vec2 lensPosition = (distort(vec4(inputPosition, 0.0f, 1.0f)).xy * 0.5f + 0.5f) * lensExtent;
+
+	outputColor = texture(colorSampler, lensPosition);
+	gl_FragDepth = texture(depthSampler, lensPosition).r;
+}
@@ -0,0 +1,10 @@
+#version 460 core
+
+layout(location = 0) out vec2 outputPosition;
+
+void main()
+{
+	outputPosition = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0f - 1.0f;
+
+	gl_Position = vec4(outputPosition, 0.0f, 1.0f);
+}